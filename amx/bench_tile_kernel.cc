@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "isa.hpp"
+#include "tile_kernel.hpp"
+#include "CLI11.hpp"
+
+int main(int argc, char **argv) {
+  CLI::App app{"Native AMX tile kernel against its portable emulation"};
+  argv = app.ensure_utf8(argv);
+
+  int64_t nq = 100;
+  app.add_option("--nq", nq, "Number of queries");
+
+  int64_t nl = 100000;
+  app.add_option("--nl", nl, "Number of dataset vectors");
+
+  int64_t dim = 200;
+  app.add_option("--dim", dim, "Vector dimension");
+
+  int64_t iters = 10;
+  app.add_option("--iters", iters, "Timed iterations per kernel");
+
+  int32_t max_exponent = 0;
+  app.add_option("--max-exponent", max_exponent,
+                 "Scale every value by 2^e, e uniform in [-max, max], to reach denormals");
+
+  CLI11_PARSE(app, argc, argv);
+
+  Isa isa = detect_isa();
+  std::cout << "[INFO] ISA: " << isa_name(isa) << std::endl;
+
+  std::mt19937 gen(42);
+  std::normal_distribution<float> dist;
+  std::uniform_int_distribution<int32_t> exponent(-max_exponent, max_exponent);
+  std::vector<float> q(nq * dim), x(nl * dim);
+  for (auto &v : q) {
+    v = std::ldexp(dist(gen), exponent(gen));
+  }
+  for (auto &v : x) {
+    v = std::ldexp(dist(gen), exponent(gen));
+  }
+
+  int32_t kp = tile_padded_dim(dim);
+  int32_t nq_pad = tile_padded_rows(nq);
+  int32_t nl_pad = tile_padded_rows(nl);
+  std::vector<uint16_t> q_packed((int64_t)nq_pad * kp), x_packed((int64_t)nl_pad * kp);
+  tile_pack_queries(q.data(), nq, dim, q_packed.data());
+  tile_pack_dataset(x.data(), nl, dim, x_packed.data());
+
+  auto bench = [&](const char *name, auto score, std::vector<float> &out) {
+    out.assign((int64_t)nq_pad * nl_pad, 0.0f);
+    score(q_packed.data(), nq_pad, x_packed.data(), nl_pad, kp, out.data(), nl_pad, nullptr);
+    auto s = std::chrono::high_resolution_clock::now();
+    for (int64_t it = 0; it < iters; it++) {
+      score(q_packed.data(), nq_pad, x_packed.data(), nl_pad, kp, out.data(), nl_pad, nullptr);
+    }
+    auto e = std::chrono::high_resolution_clock::now();
+    double us = std::chrono::duration_cast<std::chrono::microseconds>(e - s).count() / (double)iters;
+    std::cout
+        << "[TIME] Score: [ " << name << " ][ " << nq << " x " << nl << " x " << dim << " ]: "
+        << us << " us ( " << 2.0 * nq * nl * dim / us / 1e3 << " GFLOP/s )" << std::endl;
+  };
+
+  std::vector<float> emulated, native;
+  bench("emulated", tile_score_emulated, emulated);
+  if (isa >= Isa::AMX_BF16) {
+    bench("amx", tile_score_amx, native);
+    int64_t exact = 0;
+    double max_err = 0.0;
+    for (size_t i = 0; i < native.size(); i++) {
+      exact += std::memcmp(&emulated[i], &native[i], sizeof(float)) == 0;
+      max_err = std::max(max_err, std::fabs((double)emulated[i] - native[i]));
+    }
+    std::cout << "[INFO] AMX scores bit-identical to emulation: " << exact << " / "
+              << native.size() << std::endl;
+    if (exact != (int64_t)native.size()) {
+      std::cerr << "[ERROR] Emulation differs from AMX by up to " << max_err << std::endl;
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,118 @@
+#include <chrono>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include "topk.hpp"
+#include "CLI11.hpp"
+
+struct Comp {
+  bool operator()(const std::pair<int32_t, float> &a, const std::pair<int32_t, float> &b) const {
+    return a.second > b.second;
+  }
+};
+
+// The priority_queue loop search_ip_amx used before the arena heaps, with
+// the heap direction fixed to keep the largest inner products
+void select_priority_queue(const float *scores, int32_t nq, int32_t nl, int32_t top_k,
+                           float *dis, int64_t *ids) {
+  #pragma omp parallel for
+  for (int32_t i = 0; i < nq; i++) {
+    std::priority_queue<
+      std::pair<int32_t, float>,
+      std::vector<std::pair<int32_t, float>>,
+      Comp
+    > local_queue;
+    for (int32_t j = 0; j < nl; j++) {
+      float dist = scores[(int64_t)i * nl + j];
+      if ((int32_t)local_queue.size() < top_k) {
+        local_queue.push({j, dist});
+      } else if (local_queue.top().second < dist) {
+        local_queue.pop();
+        local_queue.push({j, dist});
+      }
+    }
+    for (int32_t n = top_k - 1; n >= 0; n--) {
+      ids[(int64_t)i * top_k + n] = local_queue.top().first;
+      dis[(int64_t)i * top_k + n] = local_queue.top().second;
+      local_queue.pop();
+    }
+  }
+}
+
+template <Isa ISA>
+void select_heap(const float *scores, int32_t nq, int32_t nl, int32_t top_k,
+                 float *dis, int64_t *ids) {
+  auto add_row = select_heap_add_row<true>(ISA);
+  #pragma omp parallel for
+  for (int32_t i = 0; i < nq; i++) {
+    float *d = dis + (int64_t)i * top_k;
+    int64_t *l = ids + (int64_t)i * top_k;
+    heap_init<true>(d, l, top_k);
+    add_row(d, l, top_k, scores + (int64_t)i * nl, nl, 0);
+    heap_sort<true>(d, l, top_k);
+  }
+}
+
+int main(int argc, char **argv) {
+  CLI::App app{"Top-k selection microbenchmark"};
+  argv = app.ensure_utf8(argv);
+
+  int64_t nq = 100;
+  app.add_option("--nq", nq, "Number of score rows");
+
+  int64_t nl = 1000000;
+  app.add_option("--nl", nl, "Number of scores per row");
+
+  int64_t iters = 5;
+  app.add_option("--iters", iters, "Timed iterations per selector");
+
+  CLI11_PARSE(app, argc, argv);
+
+  Isa isa = detect_isa();
+  std::cout << "[INFO] ISA: " << isa_name(isa) << std::endl;
+
+  std::vector<float> scores(nq * nl);
+  std::mt19937 gen(42);
+  std::normal_distribution<float> dist;
+  for (auto &s : scores) {
+    s = dist(gen);
+  }
+
+  for (int32_t top_k : {1, 10, 100, 1000}) {
+    std::vector<float> ref_dis(nq * top_k), dis(nq * top_k);
+    std::vector<int64_t> ref_ids(nq * top_k), ids(nq * top_k);
+
+    auto bench = [&](const char *name, auto select, float *d, int64_t *l) {
+      select(scores.data(), nq, nl, top_k, d, l);
+      auto s = std::chrono::high_resolution_clock::now();
+      for (int64_t it = 0; it < iters; it++) {
+        select(scores.data(), nq, nl, top_k, d, l);
+      }
+      auto e = std::chrono::high_resolution_clock::now();
+      double us = std::chrono::duration_cast<std::chrono::microseconds>(e - s).count() / (double)iters;
+      std::cout
+          << "[TIME] Select: [ " << name << " ][ k: " << top_k << " ][ " << nq << " x " << nl << " ]: "
+          << us << " us ( " << (double)nq * nl / us / 1e3 << " Gscores/s )" << std::endl;
+    };
+
+    bench("priority_queue", select_priority_queue, ref_dis.data(), ref_ids.data());
+    bench("heap", select_heap<Isa::SCALAR>, dis.data(), ids.data());
+    bool heap_ok = dis == ref_dis;
+    bool avx2_ok = false, avx512_ok = false;
+    if (isa >= Isa::AVX2) {
+      bench("heap_avx2", select_heap<Isa::AVX2>, dis.data(), ids.data());
+      avx2_ok = dis == ref_dis;
+    }
+    if (isa >= Isa::AVX512F) {
+      bench("heap_avx512", select_heap<Isa::AVX512F>, dis.data(), ids.data());
+      avx512_ok = dis == ref_dis;
+    }
+    std::cout << "[INFO] k: " << top_k << " distances match priority_queue: heap "
+              << (heap_ok ? "yes" : "no") << ", heap_avx2 " << (avx2_ok ? "yes" : "no")
+              << ", heap_avx512 " << (avx512_ok ? "yes" : "no") << std::endl;
+  }
+
+  return 0;
+}
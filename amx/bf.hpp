@@ -1,98 +1,998 @@
 #pragma once
 
-#include <queue>
+#include <algorithm>
+#include <cmath>
 #include <vector>
 #include <iostream>
-#include <map>
+#include <memory>
+#include <omp.h>
+#include <string>
+
+#include <fstream>
 
 #include "distance.hpp"
+#include "gemv.hpp"
+#include "isa.hpp"
+#include "packed.hpp"
+#include "phase_timer.hpp"
+#include "tile_kernel.hpp"
+#include "topk.hpp"
+
+enum class Metric {
+  INNER_PRODUCT,
+  L2,
+  COSINE,
+};
+
+// Whether larger scores are better matches under the metric
+inline bool keep_largest(Metric metric) {
+  return metric != Metric::L2;
+}
 
-struct Comp {
-  // >: top is minimum / min heap
-  // <: top is maximum / max heap
-  static bool operator()(const std::pair<int, float> &a, const std::pair<int, float> &b) {
-    return a.second < b.second;
+// Map a --metric value (ip, l2, cosine) to a Metric, false if unknown
+inline bool parse_metric(const std::string &name, Metric *metric) {
+  if (name == "ip") {
+    *metric = Metric::INNER_PRODUCT;
+  } else if (name == "l2") {
+    *metric = Metric::L2;
+  } else if (name == "cosine") {
+    *metric = Metric::COSINE;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+inline float squared_norm(const float *x, int32_t dim) {
+  float s = 0;
+  for (int32_t c = 0; c < dim; c++) {
+    s += x[c] * x[c];
+  }
+  return s;
+}
+
+// Scale x to unit length in place, leaving zero vectors untouched
+inline void normalize(float *x, int32_t dim) {
+  float n = std::sqrt(squared_norm(x, dim));
+  if (n > 0) {
+    for (int32_t c = 0; c < dim; c++) {
+      x[c] /= n;
+    }
+  }
+}
+
+// The vector actually packed for the metric: -2x for L2, x / ||x|| for
+// cosine and x itself for inner product
+inline void transform_vector(Metric metric, const float *src, float *dst, int32_t dim) {
+  if (metric == Metric::L2) {
+    for (int32_t c = 0; c < dim; c++) {
+      dst[c] = -2.0f * src[c];
+    }
+  } else {
+    std::copy(src, src + dim, dst);
+    if (metric == Metric::COSINE) {
+      normalize(dst, dim);
+    }
   }
+}
+
+// How int8 dataset values are scaled into [-127, 127]
+enum class Int8Scale {
+  PER_VECTOR,
+  PER_DIMENSION,
+};
+
+// Map an --int8-scale value (vector, dim) to an Int8Scale, false if unknown
+inline bool parse_int8_scale(const std::string &name, Int8Scale *scale) {
+  if (name == "vector") {
+    *scale = Int8Scale::PER_VECTOR;
+  } else if (name == "dim") {
+    *scale = Int8Scale::PER_DIMENSION;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// How the top-k selection of a scored tile is split over threads: by
+// query, by column shards of the tile, or by (query, shard) pairs
+enum class Parallelism {
+  AUTO,
+  QUERY,
+  SHARD,
+  GRID,
+};
+
+// Map a --parallelism value (auto, query, shard, grid), false if unknown
+inline bool parse_parallelism(const std::string &name, Parallelism *parallelism) {
+  if (name == "auto") {
+    *parallelism = Parallelism::AUTO;
+  } else if (name == "query") {
+    *parallelism = Parallelism::QUERY;
+  } else if (name == "shard") {
+    *parallelism = Parallelism::SHARD;
+  } else if (name == "grid") {
+    *parallelism = Parallelism::GRID;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Which GEMM scores the tiles: oneDNN, the hand-written AMX tile kernel,
+// or its portable emulation
+enum class Kernel {
+  ONEDNN,
+  AMX_TILE,
+  EMULATED,
 };
 
+// Map a --kernel value (onednn, amx, emulated) to a Kernel, false if unknown
+inline bool parse_kernel(const std::string &name, Kernel *kernel) {
+  if (name == "onednn") {
+    *kernel = Kernel::ONEDNN;
+  } else if (name == "amx") {
+    *kernel = Kernel::AMX_TILE;
+  } else if (name == "emulated") {
+    *kernel = Kernel::EMULATED;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Default set_small_batch_threshold() of every flat search. On one Sapphire
+// Rapids core over 1M x 200 bf16 rows the GEMV scan beat the native AMX tile
+// kernel up to nq 5 (25.9 vs 29.5 ms at nq 1) and lost from nq 8 (37.9 vs
+// 30.4 ms); the oneDNN GEMM adds its per-call setup on top of that kernel.
+static constexpr int32_t SMALL_BATCH_THRESHOLD = 4;
+
+/**
+ * @brief Exact search over a dataset held as bf16 (or int8) tiles.
+ *
+ * The dataset is split into tiles of `tile_rows` vectors and the queries
+ * into blocks of `query_block` vectors. Each (query block, tile) GEMM
+ * writes a small score matrix that is consumed by the per-query heaps
+ * before the next tile is scored, so the full nq x nl score matrix is
+ * never materialized and memory stays bounded by query_block x tile_rows.
+ *
+ * L2 is scored as ||x||^2 - 2<q,x>: the dataset is packed as -2x and its
+ * squared norms are added as the GEMM bias, so the ranking comes straight
+ * out of the GEMM and ||q||^2 is only added to the final k results.
+ * Cosine normalizes the dataset at ingest and the queries per block, then
+ * ranks by inner product.
+ *
+ * In int8 mode each dataset vector (or each dimension) gets its own scale
+ * at ingest, each query block is quantized with one common scale, and the
+ * GEMM runs int8 x int8 -> s32. Optionally the best k * rerank_factor int8
+ * candidates are rescored exactly in f32.
+ *
+ * The instruction set is detected at construction. Without AVX512-BF16 or
+ * AMX-BF16 the tiles are kept in f32 instead of bf16, and the top-k
+ * selection uses the widest compare the CPU offers.
+ *
+ * With set_kernel() the oneDNN GEMM can be replaced by the native AMX tile
+ * kernel of tile_kernel.hpp, or by its portable emulation. Tiles are then
+ * kept in that kernel's own VNNI layout and the whole query block is
+ * scored against a tile in one call.
+ *
+ * The selection over a scored tile is parallel over the queries of the
+ * block when there are at least as many of them as threads. With fewer
+ * queries each tile is also split into column shards, every (query, shard)
+ * pair feeding its own heap, and the shards of a query are merged at the
+ * end; a single query is split over shards only. set_parallelism() forces
+ * one of the three.
+ *
+ * Small batches (nq up to set_small_batch_threshold()) skip the GEMM on
+ * AVX-512 machines: the dataset is kept as packed bf16 blocks and
+ * streamed through the GEMV kernel of gemv.hpp, split by blocks over all
+ * threads, each keeping partial top-k heaps that are merged at the end.
+ *
+ * phase_profile() breaks the last add() and the last search() down into
+ * the phases of phase_timer.hpp. The fused GEMV scan of small batches
+ * counts as its GEMM.
+ */
 class BruteForceSearch {
   int32_t _dim;
   int32_t _nq;
   int32_t _nl;
+  int32_t _tile_rows;
+  int32_t _query_block;
+  Metric _metric;
+  Isa _isa;
+
+  bool _int8 = false;
+  Int8Scale _int8_scale = Int8Scale::PER_VECTOR;
+  int32_t _rerank_factor = 0;
+  std::vector<float> _dim_scales;
+  const float *_data = nullptr;
 
   dnnl::engine engine;
   dnnl::stream stream;
 
+  // One primitive for full tiles and one for the trailing partial tile,
+  // which reads the source of the first when their layouts match
+  std::unique_ptr<AMXInnerProduct> _ip_full;
+  std::unique_ptr<AMXInnerProduct> _ip_tail;
+  bool _tail_shares_src = false;
+  std::vector<dnnl::memory> _tiles;
+  std::vector<dnnl::memory> _biases;
+  std::vector<dnnl::memory> _scales;
+
+  // Backing storage of tiles loaded from a packed dataset file
+  std::unique_ptr<MappedFile> _file;
+
+  // Tiles, L2 biases and scratch of the native tile kernels
+  Kernel _kernel = Kernel::ONEDNN;
+  std::vector<std::vector<uint16_t>> _native_tiles;
+  std::vector<std::vector<float>> _native_biases;
+
+  // Packed bf16 dataset and L2 biases of the small-batch path;
+  // SMALL_BATCH_ROWS is a multiple of TILE_ROWS
+  static constexpr int32_t SMALL_BATCH_ROWS = 256;
+  int32_t _small_batch_threshold = SMALL_BATCH_THRESHOLD;
+  bool _small_batch = false;
+  std::vector<uint16_t> _rows;
+  std::vector<float> _row_bias;
+
+  // Narrowest column shard worth a heap of its own
+  static constexpr int32_t MIN_SHARD_COLUMNS = 512;
+  Parallelism _parallelism = Parallelism::AUTO;
+
+  PhaseProfile _profile;
+
 public:
   void init_onednn() {
     engine = dnnl::engine(dnnl::engine::kind::cpu, 0);
     stream = dnnl::stream(engine);
   }
 
-  BruteForceSearch(int32_t dim, int32_t nq, int32_t nl) : _dim(dim), _nq(nq), _nl(nl) {
+  BruteForceSearch(int32_t dim, int32_t nq, int32_t nl,
+                   int32_t tile_rows = 4096, int32_t query_block = 128,
+                   Metric metric = Metric::INNER_PRODUCT)
+      : _dim(dim), _nq(nq), _nl(nl), _metric(metric) {
+    _tile_rows = std::min(tile_rows, nl);
+    _query_block = std::min(query_block, nq);
     init_onednn();
-    if (!is_amxbf16_supported()) {
-      std::cout << "Intel AMX unavailable" << std::endl;
-    }
-  }
-
-  std::vector<std::vector<int>> search_ip_amx(
-    std::vector<float> &queries, std::vector<float> &dataset, int32_t top_k) {
-    
-    auto dst_mem =  amx_inner_product(
-      _nq, _nl, _dim, queries, dataset, engine, stream
-    );
-    float *dst_mem_buffer = static_cast<float*>(dst_mem.get_data_handle());
-
-    std::unordered_map<
-      int32_t, 
-      std::priority_queue<
-        std::pair<int32_t, float>, 
-        std::vector<std::pair<int32_t, float>>, 
-        Comp
-      >>
-    m;
-    
+    _isa = detect_isa();
+  }
+
+  /**
+   * @brief Use a slower instruction set than the detected one. Must be called
+   * before add() or load(); see limit_onednn_isa() for the GEMM itself.
+   */
+  void set_isa(Isa isa) {
+    _isa = std::min(_isa, isa);
+  }
+
+  Isa isa() const { return _isa; }
+
+  const PhaseProfile &phase_profile() const { return _profile; }
+
+  // Human readable summary of the kernels picked for this machine
+  std::string describe_dispatch() const {
+    const char *gemm = _int8 ? "int8" : (gemm_data_type() == dt::bf16 ? "bf16" : "f32");
+    if (_small_batch) {
+      gemm = _isa >= Isa::AVX512_BF16 ? "bf16 avx512 dpbf16 gemv" : "bf16 avx512 gemv";
+    } else if (_kernel == Kernel::AMX_TILE) {
+      gemm = "bf16 amx tile kernel";
+    } else if (_kernel == Kernel::EMULATED) {
+      gemm = "bf16 emulated tile kernel";
+    }
+    const char *topk = _isa >= Isa::AVX512F ? "avx512" : (_isa >= Isa::AVX2 ? "avx2" : "scalar");
+    std::string select = "shards";
+    if (!_small_batch) {
+      Parallelism mode;
+      int32_t shards = plan_selection(&mode);
+      select = mode == Parallelism::QUERY ? std::string("query") :
+               mode == Parallelism::SHARD ? std::to_string(shards) + " shards" :
+               std::to_string(_query_block) + " x " + std::to_string(shards) + " grid";
+    }
+    return std::string(isa_name(_isa)) + " ( gemm: " + gemm + ", top-k: " + topk +
+           ", select: " + select + " )";
+  }
+
+  /**
+   * @brief Store and score the dataset as int8 instead of bf16. Must be
+   * called before add().
+   *
+   * @param scale Per-vector or per-dimension quantization scales
+   * @param rerank_factor If > 0, the best top_k * rerank_factor int8
+   *        candidates are rescored in f32 against the dataset passed to
+   *        add(), which must then outlive the searches
+   */
+  void set_int8(Int8Scale scale, int32_t rerank_factor) {
+    if (_kernel != Kernel::ONEDNN) {
+      throw std::runtime_error("int8 requires the oneDNN kernel");
+    }
+    _int8 = true;
+    _int8_scale = scale;
+    _rerank_factor = rerank_factor;
+  }
+
+  /**
+   * @brief Score tiles with the given kernel instead of oneDNN. Must be
+   * called before add(); the native kernels support bf16 add() and search()
+   * only, not int8 or packed dataset files.
+   */
+  void set_kernel(Kernel kernel) {
+    if (kernel == Kernel::AMX_TILE && _isa < Isa::AMX_BF16) {
+      throw std::runtime_error("The AMX tile kernel needs AMX-BF16");
+    }
+    if (kernel != Kernel::ONEDNN && _int8) {
+      throw std::runtime_error("int8 requires the oneDNN kernel");
+    }
+    _kernel = kernel;
+  }
+
+  Kernel kernel() const { return _kernel; }
+
+  /**
+   * @brief Score batches of at most nq queries with the small-batch GEMV
+   * path instead of the GEMM (0 disables it). Must be called before add();
+   * only applies to bf16 with the oneDNN kernel on AVX-512 machines.
+   */
+  void set_small_batch_threshold(int32_t nq) {
+    _small_batch_threshold = nq;
+  }
+
+  // Split the top-k selection this way instead of choosing from nq, the
+  // tile size and the thread count
+  void set_parallelism(Parallelism parallelism) {
+    _parallelism = parallelism;
+  }
+
+  void add(std::vector<float> &dataset) {
+    add(dataset.data());
+  }
+
+  // Same as add() on nl x dim floats owned elsewhere, e.g. a DatasetView;
+  // they must outlive the searches only for int8 reranking
+  void add(const float *dataset) {
+    _profile.reset();
+    _data = dataset;
+    _small_batch = !_int8 && _kernel == Kernel::ONEDNN && _isa >= Isa::AVX512F &&
+                   _nq <= _small_batch_threshold;
+    if (_small_batch) {
+      add_small_batch(dataset);
+      return;
+    }
+    if (_kernel != Kernel::ONEDNN) {
+      add_native(dataset);
+      return;
+    }
+    bool with_bias = _metric == Metric::L2;
+    create_primitives();
+
+    if (_int8 && _int8_scale == Int8Scale::PER_DIMENSION) {
+      compute_dim_scales(dataset);
+    }
+
+    _tiles.clear();
+    _biases.clear();
+    _scales.clear();
+    std::vector<float> tile_buf((int64_t)_tile_rows * _dim);
+    std::vector<float> norms(_tile_rows);
+    std::vector<float> scales(_tile_rows, 1.0f);
+    for (int32_t t = 0; t < _nl; t += _tile_rows) {
+      int32_t rows = std::min(_tile_rows, _nl - t);
+      auto &ip = (rows == _tile_rows) ? _ip_full : _ip_tail;
+      const float *x = dataset + (int64_t)t * _dim;
+      if (_metric == Metric::INNER_PRODUCT && !_int8) {
+        _tiles.push_back(ip->pack_weights(x));
+        continue;
+      }
+
+      #pragma omp parallel for
+      for (int32_t j = 0; j < rows; j++) {
+        const float *src = x + (int64_t)j * _dim;
+        float *dst = tile_buf.data() + (int64_t)j * _dim;
+        if (_metric == Metric::L2) {
+          norms[j] = squared_norm(src, _dim);
+        }
+        transform_row(src, dst);
+        if (_int8) {
+          scales[j] = quantize_row(dst);
+        }
+      }
+      _tiles.push_back(ip->pack_weights(tile_buf.data()));
+      if (with_bias) {
+        _biases.push_back(ip->pack_bias(norms.data()));
+      }
+      if (_int8) {
+        _scales.push_back(ip->pack_scales(scales.data()));
+      }
+    }
+  }
+
+  /**
+   * @brief Write the packed bf16 tiles built by add() to a file that load()
+   * can map back without any conversion.
+   */
+  void save(const std::string &path) {
+    if (_int8) {
+      throw std::runtime_error("int8 datasets cannot be saved");
+    }
+    if (_kernel != Kernel::ONEDNN || _small_batch) {
+      throw std::runtime_error("Only oneDNN tiles can be saved");
+    }
+    auto full_blob = _ip_full->weights_desc().get_blob();
+    std::vector<uint8_t> tail_blob;
+    if (_ip_tail) {
+      tail_blob = _ip_tail->weights_desc().get_blob();
+    }
+
+    PackedHeader h = {};
+    std::memcpy(h.magic, PACKED_MAGIC, sizeof(PACKED_MAGIC));
+    h.version = PACKED_VERSION;
+    h.metric = (uint32_t)_metric;
+    h.n = _nl;
+    h.dim = _dim;
+    h.tile_rows = _tile_rows;
+    h.query_block = _query_block;
+    h.full_desc_size = full_blob.size();
+    h.tail_desc_size = tail_blob.size();
+    h.full_tile_bytes = _ip_full->weights_desc().get_size();
+    h.tail_tile_bytes = _ip_tail ? _ip_tail->weights_desc().get_size() : 0;
+    h.tiles_offset = packed_align_up(sizeof(h) + full_blob.size() + tail_blob.size());
+
+    std::ofstream out(path, std::ofstream::binary);
+    out.write((char *)&h, sizeof(h));
+    out.write((char *)full_blob.data(), full_blob.size());
+    out.write((char *)tail_blob.data(), tail_blob.size());
+    std::vector<char> pad(PACKED_ALIGN, 0);
+    int64_t pos = sizeof(h) + full_blob.size() + tail_blob.size();
+    for (auto &tile : _tiles) {
+      out.write(pad.data(), packed_align_up(pos) - pos);
+      pos = packed_align_up(pos);
+      int64_t bytes = tile.get_desc().get_size();
+      out.write((char *)tile.get_data_handle(), bytes);
+      pos += bytes;
+    }
+    out.write(pad.data(), packed_align_up(pos) - pos);
+    pos = packed_align_up(pos);
+    h.norms_offset = pos;
+    for (auto &bias : _biases) {
+      int64_t bytes = bias.get_desc().get_size();
+      out.write((char *)bias.get_data_handle(), bytes);
+      pos += bytes;
+    }
+    out.seekp(0);
+    out.write((char *)&h, sizeof(h));
+    if (!out) {
+      throw std::runtime_error("Could not write " + path);
+    }
+  }
+
+  /**
+   * @brief Map a file written by save() and use its tiles in place of add().
+   *
+   * Tiles are used straight from the page cache when their layout matches
+   * what this machine's primitive prefers; otherwise they are reordered.
+   */
+  void load(const std::string &path) {
+    if (_int8) {
+      throw std::runtime_error("int8 datasets cannot be loaded");
+    }
+    if (_kernel != Kernel::ONEDNN) {
+      throw std::runtime_error("Packed datasets can only be loaded into oneDNN tiles");
+    }
+    _file = std::make_unique<MappedFile>(path);
+    PackedHeader h = read_packed_header(*_file);
+    if (h.n != _nl || h.dim != _dim || h.metric != (uint32_t)_metric) {
+      throw std::runtime_error("Packed dataset does not match the index shape or metric");
+    }
+    _profile.reset();
+    _data = nullptr;
+    _small_batch = false;
+    _tile_rows = h.tile_rows;
+    create_primitives();
+
+    const uint8_t *base = _file->data();
+    dnnl::memory::desc full_md(std::vector<uint8_t>(
+      base + sizeof(h), base + sizeof(h) + h.full_desc_size));
+    dnnl::memory::desc tail_md;
+    if (h.tail_desc_size > 0) {
+      const uint8_t *blob = base + sizeof(h) + h.full_desc_size;
+      tail_md = dnnl::memory::desc(std::vector<uint8_t>(blob, blob + h.tail_desc_size));
+    }
+
+    _tiles.clear();
+    _biases.clear();
+    _scales.clear();
+    int64_t pos = h.tiles_offset;
+    int64_t copied = 0;
+    for (int32_t t = 0; t < _nl; t += _tile_rows) {
+      bool full = _nl - t >= _tile_rows;
+      auto &ip = full ? _ip_full : _ip_tail;
+      auto &md = full ? full_md : tail_md;
+      pos = packed_align_up(pos);
+      _tiles.push_back(ip->import_weights(md, base + pos));
+      copied += (_tiles.back().get_data_handle() != base + pos);
+      pos += full ? h.full_tile_bytes : h.tail_tile_bytes;
+    }
+    if (_metric == Metric::L2) {
+      const float *norms = reinterpret_cast<const float *>(base + h.norms_offset);
+      for (int32_t t = 0; t < _nl; t += _tile_rows) {
+        auto &ip = (_nl - t >= _tile_rows) ? _ip_full : _ip_tail;
+        _biases.push_back(ip->pack_bias(norms + t));
+      }
+    }
+    if (copied > 0) {
+      std::cout << "[INFO] Packed layout differs from this machine's, reordered "
+                << copied << " tiles" << std::endl;
+    }
+  }
+
+  /**
+   * @brief Find the top_k nearest dataset vectors for every query.
+   *
+   * @param queries Row-major (nq x dim) f32 queries
+   * @param top_k Number of neighbors per query
+   * @param distances Output (nq x top_k) scores, best first per query
+   * @param labels Output (nq x top_k) dataset ids, -1 when nl < top_k
+   */
+  void search(std::vector<float> &queries, int32_t top_k,
+              float *distances, int64_t *labels) {
+    search(queries.data(), top_k, distances, labels);
+  }
+
+  // Same as search() on nq x dim queries owned elsewhere
+  void search(const float *queries, int32_t top_k,
+              float *distances, int64_t *labels) {
+    _profile.reset(Phase::QUERY_PREP);
+    if (_small_batch) {
+      if (keep_largest(_metric)) {
+        search_small_batch<true>(queries, top_k, distances, labels);
+      } else {
+        search_small_batch<false>(queries, top_k, distances, labels);
+      }
+      return;
+    }
+    if (keep_largest(_metric)) {
+      search_impl<true>(queries, top_k, distances, labels);
+    } else {
+      search_impl<false>(queries, top_k, distances, labels);
+    }
+  }
+
+private:
+  dt gemm_data_type() const {
+    return _isa >= Isa::AVX512_BF16 ? dt::bf16 : dt::f32;
+  }
+
+  void create_primitives() {
+    ScopedPhase phase(&_profile, Phase::PRIMITIVE_CREATE);
+    bool with_bias = _metric == Metric::L2;
+    dt data_type = _int8 ? dt::s8 : gemm_data_type();
+    int32_t tail_rows = _nl % _tile_rows;
+    _ip_full = std::make_unique<AMXInnerProduct>(
+      _query_block, _tile_rows, _dim, engine, stream, with_bias, data_type);
+    _ip_full->set_profile(&_profile);
+    _ip_tail.reset();
+    _tail_shares_src = false;
+    if (tail_rows > 0) {
+      _ip_tail = std::make_unique<AMXInnerProduct>(
+        _query_block, tail_rows, _dim, engine, stream, with_bias, data_type);
+      _ip_tail->set_profile(&_profile);
+      _tail_shares_src = _ip_tail->share_src(*_ip_full);
+    }
+  }
+
+  // Pack every tile into the native kernels' VNNI layout, zero-padding the
+  // vectors to a multiple of 16 and the dimension to a multiple of 32
+  void add_native(const float *data) {
+    int32_t kp = tile_padded_dim(_dim);
+    _native_tiles.clear();
+    _native_biases.clear();
+    std::vector<float> tile_buf((int64_t)_tile_rows * _dim);
+    for (int32_t t = 0; t < _nl; t += _tile_rows) {
+      int32_t rows = std::min(_tile_rows, _nl - t);
+      const float *x = data + (int64_t)t * _dim;
+      std::vector<float> norms;
+      if (_metric == Metric::L2) {
+        norms.assign(tile_padded_rows(rows), 0.0f);
+      }
+      #pragma omp parallel for
+      for (int32_t j = 0; j < rows; j++) {
+        const float *src = x + (int64_t)j * _dim;
+        if (_metric == Metric::L2) {
+          norms[j] = squared_norm(src, _dim);
+        }
+        transform_row(src, tile_buf.data() + (int64_t)j * _dim);
+      }
+      _native_tiles.emplace_back((int64_t)tile_padded_rows(rows) * kp);
+      ScopedPhase phase(&_profile, Phase::DATASET_REORDER,
+                        (double)rows * _dim * sizeof(float) +
+                          _native_tiles.back().size() * sizeof(uint16_t));
+      tile_pack_dataset(tile_buf.data(), rows, _dim, _native_tiles.back().data());
+      if (_metric == Metric::L2) {
+        _native_biases.push_back(std::move(norms));
+      }
+    }
+  }
+
+  // Keep the transformed dataset as packed bf16 blocks of 16 rows for the
+  // GEMV kernel
+  void add_small_batch(const float *data) {
+    int32_t kp = tile_padded_dim(_dim);
+    int32_t n_blocks = tile_padded_rows(_nl) / TILE_ROWS;
+    ScopedPhase phase(&_profile, Phase::DATASET_REORDER,
+                      (double)_nl * _dim * sizeof(float) +
+                        (double)n_blocks * TILE_ROWS * kp * sizeof(uint16_t));
+    _rows.resize((int64_t)n_blocks * TILE_ROWS * kp);
+    _row_bias.clear();
+    if (_metric == Metric::L2) {
+      _row_bias.resize(_nl);
+    }
+    #pragma omp parallel
+    {
+      std::vector<float> block((int64_t)TILE_ROWS * _dim);
+      #pragma omp for
+      for (int32_t b = 0; b < n_blocks; b++) {
+        int32_t j0 = b * TILE_ROWS;
+        int32_t rows = std::min(TILE_ROWS, _nl - j0);
+        for (int32_t r = 0; r < rows; r++) {
+          const float *src = data + (int64_t)(j0 + r) * _dim;
+          if (_metric == Metric::L2) {
+            _row_bias[j0 + r] = squared_norm(src, _dim);
+          }
+          transform_row(src, block.data() + (int64_t)r * _dim);
+        }
+        tile_pack_dataset(block.data(), rows, _dim, _rows.data() + (int64_t)j0 * kp);
+      }
+    }
+  }
+
+  /**
+   * @brief Number of column shards each scored tile is split into for the
+   * top-k selection, for a full query block and the current thread count.
+   *
+   * @param mode Set to the selection parallelism actually used
+   */
+  int32_t plan_selection(Parallelism *mode) const {
+    int32_t nt = omp_get_max_threads();
+    int32_t max_shards = std::max(1, _tile_rows / MIN_SHARD_COLUMNS);
+    *mode = _parallelism;
+    if (*mode == Parallelism::AUTO) {
+      *mode = (_query_block >= nt || max_shards == 1) ? Parallelism::QUERY :
+              (_query_block == 1 ? Parallelism::SHARD : Parallelism::GRID);
+    }
+    switch (*mode) {
+      case Parallelism::SHARD:
+        return std::min(nt, max_shards);
+      case Parallelism::GRID:
+        return std::min((nt + _query_block - 1) / _query_block, max_shards);
+      default:
+        return 1;
+    }
+  }
+
+  void transform_row(const float *src, float *dst) {
+    transform_vector(_metric, src, dst, _dim);
+  }
+
+  // Largest magnitude of every transformed dimension over the dataset
+  void compute_dim_scales(const float *data) {
+    _dim_scales.assign(_dim, 0.0f);
+    #pragma omp parallel
+    {
+      std::vector<float> local(_dim, 0.0f), row(_dim);
+      #pragma omp for nowait
+      for (int32_t j = 0; j < _nl; j++) {
+        transform_row(data + (int64_t)j * _dim, row.data());
+        for (int32_t c = 0; c < _dim; c++) {
+          local[c] = std::max(local[c], std::fabs(row[c]));
+        }
+      }
+      #pragma omp critical
+      for (int32_t c = 0; c < _dim; c++) {
+        _dim_scales[c] = std::max(_dim_scales[c], local[c]);
+      }
+    }
+    for (auto &s : _dim_scales) {
+      s = s > 0 ? s / 127.0f : 1.0f;
+    }
+  }
+
+  // Round x to integers in [-127, 127] in place and return the row scale
+  float quantize_row(float *x) {
+    if (_int8_scale == Int8Scale::PER_DIMENSION) {
+      for (int32_t c = 0; c < _dim; c++) {
+        x[c] = std::nearbyint(std::clamp(x[c] / _dim_scales[c], -127.0f, 127.0f));
+      }
+      return 1.0f;
+    }
+    float max_abs = 0;
+    for (int32_t c = 0; c < _dim; c++) {
+      max_abs = std::max(max_abs, std::fabs(x[c]));
+    }
+    float scale = max_abs > 0 ? max_abs / 127.0f : 1.0f;
+    for (int32_t c = 0; c < _dim; c++) {
+      x[c] = std::nearbyint(x[c] / scale);
+    }
+    return scale;
+  }
+
+  // Quantize a whole query block with one common scale and return it
+  float quantize_block(float *q, int64_t n) {
+    if (_int8_scale == Int8Scale::PER_DIMENSION) {
+      for (int64_t i = 0; i < n; i++) {
+        q[i] *= _dim_scales[i % _dim];
+      }
+    }
+    float max_abs = 0;
+    for (int64_t i = 0; i < n; i++) {
+      max_abs = std::max(max_abs, std::fabs(q[i]));
+    }
+    float scale = max_abs > 0 ? max_abs / 127.0f : 1.0f;
+    for (int64_t i = 0; i < n; i++) {
+      q[i] = std::nearbyint(q[i] / scale);
+    }
+    return scale;
+  }
+
+  // Exact f32 distance between a query and a dataset vector
+  float exact_distance(const float *q, const float *x) {
+    float dot = 0, qq = 0, xx = 0;
+    for (int32_t c = 0; c < _dim; c++) {
+      dot += q[c] * x[c];
+      qq += q[c] * q[c];
+      xx += x[c] * x[c];
+    }
+    if (_metric == Metric::L2) {
+      return std::max(qq + xx - 2.0f * dot, 0.0f);
+    }
+    if (_metric == Metric::COSINE) {
+      return (qq > 0 && xx > 0) ? dot / std::sqrt(qq * xx) : 0.0f;
+    }
+    return dot;
+  }
+
+  template <bool KeepLargest>
+  void search_small_batch(const float *queries, int32_t top_k,
+                          float *out_dis, int64_t *out_ids) {
+    int32_t kp = tile_padded_dim(_dim);
+    int32_t k = top_k;
+    std::vector<uint16_t> q_buf((int64_t)_nq * kp, 0);
+    {
+      ScopedPhase phase(&_profile, Phase::QUERY_PREP);
+      std::vector<float> q(_dim);
+      for (int32_t i = 0; i < _nq; i++) {
+        std::copy(queries + (int64_t)i * _dim, queries + (int64_t)(i + 1) * _dim, q.begin());
+        if (_metric == Metric::COSINE) {
+          normalize(q.data(), _dim);
+        }
+        for (int32_t c = 0; c < _dim; c++) {
+          q_buf[(int64_t)i * kp + c] = f32_to_bf16(q[c]);
+        }
+      }
+    }
+
+    // Every thread scans its own row range into its own nq x k heaps
+    int nt = omp_get_max_threads();
+    std::vector<float> part_dis((int64_t)nt * _nq * k);
+    std::vector<int64_t> part_ids((int64_t)nt * _nq * k);
+    for (int64_t h = 0; h < (int64_t)nt * _nq; h++) {
+      heap_init<KeepLargest>(part_dis.data() + h * k, part_ids.data() + h * k, k);
+    }
+    auto add_row = select_heap_add_row<KeepLargest>(_isa);
+    auto gemv = select_gemv_score_blocks(_isa);
+
+    {
+      ScopedPhase scan(&_profile, Phase::GEMM, (double)_rows.size() * sizeof(uint16_t),
+                       2.0 * _nq * _nl * _dim);
+      #pragma omp parallel num_threads(nt)
+      {
+        int t = omp_get_thread_num();
+        int nth = omp_get_num_threads();
+        float *dis = part_dis.data() + (int64_t)t * _nq * k;
+        int64_t *ids = part_ids.data() + (int64_t)t * _nq * k;
+        // Whole blocks per thread
+        int64_t n_blocks = tile_padded_rows(_nl) / TILE_ROWS;
+        int64_t r0 = std::min<int64_t>(n_blocks * t / nth * TILE_ROWS, _nl);
+        int64_t r1 = std::min<int64_t>(n_blocks * (t + 1) / nth * TILE_ROWS, _nl);
+        std::vector<float> scores((int64_t)_nq * SMALL_BATCH_ROWS);
+        for (int64_t b = r0; b < r1; b += SMALL_BATCH_ROWS) {
+          int32_t rows = std::min<int64_t>(SMALL_BATCH_ROWS, r1 - b);
+          gemv(_rows.data() + b * kp, tile_padded_rows(rows) / TILE_ROWS, kp, q_buf.data(), _nq,
+               scores.data(), SMALL_BATCH_ROWS);
+          for (int32_t i = 0; i < _nq; i++) {
+            float *row = scores.data() + (int64_t)i * SMALL_BATCH_ROWS;
+            if (!_row_bias.empty()) {
+              for (int32_t r = 0; r < rows; r++) {
+                row[r] += _row_bias[b + r];
+              }
+            }
+            add_row(dis + (int64_t)i * k, ids + (int64_t)i * k, k, row, rows, b);
+          }
+        }
+      }
+    }
+
+    ScopedPhase merge(&_profile, Phase::MERGE);
     #pragma omp parallel for
     for (int32_t i = 0; i < _nq; i++) {
-        std::priority_queue<
-          std::pair<int32_t, float>, 
-          std::vector<std::pair<int32_t, float>>, 
-          Comp
-        > local_queue;
-        for (int32_t j = 0; j < _nl; j++) {
-            int64_t offset = (int64_t)i * (int64_t)_nl + (int64_t)j;
-            float dist = dst_mem_buffer[offset];
-            if (local_queue.size() < top_k) {
-                local_queue.push({j, dist});
-            } else {
-                if (local_queue.top().second > dist) {
-                    local_queue.pop();
-                    local_queue.push({j, dist});
-                }
-            }
+      float *d = out_dis + (int64_t)i * top_k;
+      int64_t *l = out_ids + (int64_t)i * top_k;
+      heap_init<KeepLargest>(d, l, top_k);
+      for (int t = 0; t < nt; t++) {
+        int64_t offset = ((int64_t)t * _nq + i) * k;
+        for (int32_t n = 0; n < k; n++) {
+          if (part_ids[offset + n] >= 0 && heap_better<KeepLargest>(part_dis[offset + n], d[0])) {
+            heap_replace_top<KeepLargest>(d, l, top_k, part_dis[offset + n], part_ids[offset + n]);
+          }
         }
-        #pragma omp critical
-        {
-            while (!local_queue.empty()) {
-                m[i].push(local_queue.top());
-                local_queue.pop();
-            }
+      }
+      heap_sort<KeepLargest>(d, l, top_k);
+      if (_metric == Metric::L2) {
+        float q_norm = squared_norm(queries + (int64_t)i * _dim, _dim);
+        for (int32_t n = 0; n < top_k; n++) {
+          d[n] = std::max(d[n] + q_norm, 0.0f);
         }
+      }
+    }
+  }
+
+  template <bool KeepLargest>
+  void search_impl(const float *queries, int32_t top_k,
+                   float *out_dis, int64_t *out_ids) {
+    // The heaps live in a flat nq x k arena (the output arrays themselves
+    // unless int8 candidates are reranked), so every query is owned by
+    // exactly one thread and no synchronization is needed
+    bool rerank = _int8 && _rerank_factor > 0;
+    int32_t k = rerank ? top_k * _rerank_factor : top_k;
+    std::vector<float> cand_dis;
+    std::vector<int64_t> cand_ids;
+    float *dis = out_dis;
+    int64_t *ids = out_ids;
+    if (rerank) {
+      cand_dis.resize((int64_t)_nq * k);
+      cand_ids.resize((int64_t)_nq * k);
+      dis = cand_dis.data();
+      ids = cand_ids.data();
     }
 
-    std::vector<std::vector<int>> results(
-      _nq, std::vector<int>(top_k)
-    );
+    // Shard s > 0 of a sharded selection keeps its heaps in its own nq x k
+    // slice of a second arena; shard 0 uses the main one
+    Parallelism mode;
+    int32_t shards = plan_selection(&mode);
+    std::vector<float> shard_dis((int64_t)(shards - 1) * _nq * k);
+    std::vector<int64_t> shard_ids((int64_t)(shards - 1) * _nq * k);
 
-    for (int32_t i = 0; i < _nq; i++) {
-      int32_t k_idx = top_k - 1;
-      while (k_idx >= 0) {
-        results[i][k_idx--] = m[i].top().first;
-        m[i].pop();
+    #pragma omp parallel for
+    for (int64_t h = 0; h < (int64_t)shards * _nq; h++) {
+      float *d = h < _nq ? dis + h * k : shard_dis.data() + (h - _nq) * k;
+      int64_t *l = h < _nq ? ids + h * k : shard_ids.data() + (h - _nq) * k;
+      heap_init<KeepLargest>(d, l, k);
+    }
+
+    auto add_row = select_heap_add_row<KeepLargest>(_isa);
+
+    // The last query block is zero-padded so every GEMM has the same shape
+    std::vector<float> q_buf((int64_t)_query_block * _dim);
+
+    // The native kernels score a whole query block against a tile into one
+    // (padded query block x padded tile) matrix
+    bool native = _kernel != Kernel::ONEDNN;
+    auto native_score = _kernel == Kernel::AMX_TILE ? tile_score_amx : tile_score_emulated;
+    int32_t kp = tile_padded_dim(_dim);
+    int32_t qb_pad = tile_padded_rows(_query_block);
+    int64_t ld = tile_padded_rows(_tile_rows);
+    std::vector<uint16_t> q_packed;
+    std::vector<float> native_scores;
+    if (native) {
+      q_packed.resize((int64_t)qb_pad * kp);
+      native_scores.resize(qb_pad * ld);
+    }
+
+    for (int32_t qb = 0; qb < _nq; qb += _query_block) {
+      int32_t q_rows = std::min(_query_block, _nq - qb);
+      const float *q = queries + (int64_t)qb * _dim;
+      float q_scale = 1.0f;
+      if (q_rows < _query_block || _metric == Metric::COSINE || _int8) {
+        ScopedPhase prep(&_profile, Phase::QUERY_PREP);
+        std::fill(q_buf.begin(), q_buf.end(), 0.0f);
+        std::copy(q, q + (int64_t)q_rows * _dim, q_buf.begin());
+        if (_metric == Metric::COSINE) {
+          for (int32_t i = 0; i < q_rows; i++) {
+            normalize(q_buf.data() + (int64_t)i * _dim, _dim);
+          }
+        }
+        if (_int8) {
+          q_scale = quantize_block(q_buf.data(), (int64_t)q_rows * _dim);
+        }
+        q = q_buf.data();
+      }
+      if (native) {
+        ScopedPhase reorder(&_profile, Phase::QUERY_REORDER,
+                            (double)_query_block * _dim * sizeof(float) +
+                              q_packed.size() * sizeof(uint16_t));
+        tile_pack_queries(q, _query_block, _dim, q_packed.data());
+      } else {
+        _ip_full->set_src(q, q_scale);
+      }
+
+      size_t n_tiles = native ? _native_tiles.size() : _tiles.size();
+      for (size_t t = 0; t < n_tiles; t++) {
+        int32_t base = (int32_t)t * _tile_rows;
+        int32_t rows = std::min(_tile_rows, _nl - base);
+        float *scores;
+        int64_t stride = rows;
+        if (native) {
+          ScopedPhase gemm(&_profile, Phase::GEMM,
+                           (double)_native_tiles[t].size() * sizeof(uint16_t) +
+                             q_packed.size() * sizeof(uint16_t) + native_scores.size() * sizeof(float),
+                           2.0 * _query_block * rows * _dim);
+          const float *bias = _native_biases.empty() ? nullptr : _native_biases[t].data();
+          native_score(q_packed.data(), qb_pad, _native_tiles[t].data(), tile_padded_rows(rows),
+                       kp, native_scores.data(), ld, bias);
+          scores = native_scores.data();
+          stride = ld;
+        } else {
+          auto &ip = (rows == _tile_rows) ? _ip_full : _ip_tail;
+          if (rows != _tile_rows && !_tail_shares_src) {
+            // The tail is the last tile, so this reorder runs once per block
+            ip->set_src(q, q_scale);
+          }
+          auto *bias = _biases.empty() ? nullptr : &_biases[t];
+          auto *scales = _scales.empty() ? nullptr : &_scales[t];
+          scores = static_cast<float*>(ip->compute(_tiles[t], bias, scales).get_data_handle());
+        }
+
+        // Shard boundaries are rounded down to whole 32-score compare steps
+        ScopedPhase select(&_profile, Phase::SELECT, (double)q_rows * rows * sizeof(float));
+        #pragma omp parallel for collapse(2) schedule(static)
+        for (int32_t i = 0; i < q_rows; i++) {
+          for (int32_t s = 0; s < shards; s++) {
+            int32_t c0 = (int32_t)((int64_t)rows * s / shards) / 32 * 32;
+            int32_t c1 = s + 1 == shards ? rows : (int32_t)((int64_t)rows * (s + 1) / shards) / 32 * 32;
+            int64_t offset = (int64_t)(qb + i) * k;
+            float *d = s == 0 ? dis + offset : shard_dis.data() + (s - 1) * (int64_t)_nq * k + offset;
+            int64_t *l = s == 0 ? ids + offset : shard_ids.data() + (s - 1) * (int64_t)_nq * k + offset;
+            add_row(d, l, k, scores + i * stride + c0, c1 - c0, base + c0);
+          }
+        }
       }
     }
 
-    return results;
+    ScopedPhase merge(&_profile, Phase::MERGE);
+    #pragma omp parallel for
+    for (int32_t i = 0; i < _nq; i++) {
+      const float *query = queries + (int64_t)i * _dim;
+      float *d = out_dis + (int64_t)i * top_k;
+      int64_t *l = out_ids + (int64_t)i * top_k;
+      for (int32_t s = 1; s < shards; s++) {
+        int64_t offset = ((int64_t)(s - 1) * _nq + i) * k;
+        float *dk = dis + (int64_t)i * k;
+        int64_t *lk = ids + (int64_t)i * k;
+        for (int32_t n = 0; n < k; n++) {
+          if (shard_ids[offset + n] >= 0 && heap_better<KeepLargest>(shard_dis[offset + n], dk[0])) {
+            heap_replace_top<KeepLargest>(dk, lk, k, shard_dis[offset + n], shard_ids[offset + n]);
+          }
+        }
+      }
+      if (rerank) {
+        heap_init<KeepLargest>(d, l, top_k);
+        for (int32_t n = 0; n < k; n++) {
+          int64_t id = ids[(int64_t)i * k + n];
+          if (id >= 0) {
+            float exact = exact_distance(query, _data + id * _dim);
+            if (heap_better<KeepLargest>(exact, d[0])) {
+              heap_replace_top<KeepLargest>(d, l, top_k, exact, id);
+            }
+          }
+        }
+        heap_sort<KeepLargest>(d, l, top_k);
+        continue;
+      }
+      heap_sort<KeepLargest>(d, l, top_k);
+      if (_metric == Metric::L2) {
+        float q_norm = squared_norm(query, _dim);
+        for (int32_t n = 0; n < top_k; n++) {
+          d[n] = std::max(d[n] + q_norm, 0.0f);
+        }
+      }
+    }
   }
 };
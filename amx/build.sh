@@ -1,4 +1,12 @@
 #!/bin/bash
 set -e
 
-g++ -std=c++17 -O3 run_amx.cc -ldnnl -fopenmp -march=sapphirerapids -mamx-bf16 -o run_amx
+# Kernels pick AMX / AVX-512 / AVX2 code paths at runtime, so the binaries
+# are built for the baseline ISA and only tuned for Sapphire Rapids.
+# Add -DAMX_PHASE_TIMERS=0 to compile out the per-phase search timers.
+g++ -std=c++17 -O3 run_amx.cc -ldnnl -lnuma -fopenmp -mtune=sapphirerapids -o run_amx
+g++ -std=c++17 -O3 bench_topk.cc -fopenmp -mtune=sapphirerapids -o bench_topk
+g++ -std=c++17 -O3 run_parity.cc -ldnnl -lfaiss_avx512 -fopenmp -mtune=sapphirerapids -o run_parity
+g++ -std=c++17 -O3 run_pack.cc -ldnnl -fopenmp -mtune=sapphirerapids -o run_pack
+g++ -std=c++17 -O3 bench_tile_kernel.cc -fopenmp -mtune=sapphirerapids -o bench_tile_kernel
+g++ -std=c++17 -O3 run_kmeans.cc -ldnnl -fopenmp -mtune=sapphirerapids -o run_kmeans
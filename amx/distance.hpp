@@ -1,59 +1,234 @@
 #pragma once
 
+#include <algorithm>
 #include <chrono>
-#include <immintrin.h>
 #include <unordered_map>
 
 #include "oneapi/dnnl/dnnl.hpp"
 #include "example_utils.hpp"
+#include "isa.hpp"
+#include "phase_timer.hpp"
 
 using tag = dnnl::memory::format_tag;
 using dt = dnnl::memory::data_type;
 
-static bool is_amxbf16_supported() {
-  unsigned int eax, ebx, ecx, edx;
-  __asm__ __volatile__("cpuid"
-                       : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
-                       : "a"(7), "c"(0));
-  return edx & (1 << 22);
+/**
+ * @brief Cap oneDNN at the given instruction set, so a forced lower --isa
+ * also applies to the GEMM. Must run before the first primitive is created.
+ */
+inline void limit_onednn_isa(Isa isa) {
+  switch (isa) {
+    case Isa::AMX_BF16: dnnl::set_max_cpu_isa(dnnl::cpu_isa::avx512_core_amx); break;
+    case Isa::AVX512_BF16: dnnl::set_max_cpu_isa(dnnl::cpu_isa::avx512_core_bf16); break;
+    case Isa::AVX512F: dnnl::set_max_cpu_isa(dnnl::cpu_isa::avx512_core); break;
+    case Isa::AVX2: dnnl::set_max_cpu_isa(dnnl::cpu_isa::avx2); break;
+    default: dnnl::set_max_cpu_isa(dnnl::cpu_isa::sse41); break;
+  }
 }
 
-static dnnl::memory amx_inner_product(int32_t const &n, int32_t const &oc,
-                              int32_t const &ic, std::vector<float> &src, std::vector<float> &w,
-                              dnnl::engine &engine, dnnl::stream &stream) {
-  dnnl::memory::dims s_dims = {n, ic};
-  dnnl::memory::dims w_dims = {oc, ic};
-  dnnl::memory::dims dst_dims = {n, oc};
-
-  auto s_in_md = dnnl::memory::desc(s_dims, dt::f32, tag::ab);
-  auto w_in_md = dnnl::memory::desc(w_dims, dt::f32, tag::ab);
-  auto dst_out_md = dnnl::memory::desc(dst_dims, dt::f32, tag::ab);
-  auto s_in_mem = dnnl::memory(s_in_md, engine);
-  auto w_in_mem = dnnl::memory(w_in_md, engine);
-
-  write_to_dnnl_memory(src.data(), s_in_mem);
-  write_to_dnnl_memory(w.data(), w_in_mem);
-
-  auto s_md = dnnl::memory::desc(s_dims, dt::bf16, tag::any);
-  auto w_md = dnnl::memory::desc(w_dims, dt::bf16, tag::any);
-
-  auto pd = dnnl::inner_product_forward::primitive_desc(
-      engine, dnnl::prop_kind::forward_training, s_md, w_md, dst_out_md);
-  
-  auto s_mem = dnnl::memory(pd.src_desc(), engine);
-  auto w_mem = dnnl::memory(pd.weights_desc(), engine);
-  auto dst_mem = dnnl::memory(pd.dst_desc(), engine);
-
-  dnnl::reorder(s_in_mem, s_mem).execute(stream, s_in_mem, s_mem);
-  dnnl::reorder(w_in_mem, w_mem).execute(stream, w_in_mem, w_mem);
-
-  auto prim = dnnl::inner_product_forward(pd);
-  std::unordered_map<int32_t, dnnl::memory> args;
-  args.insert({DNNL_ARG_SRC, s_mem});
-  args.insert({DNNL_ARG_WEIGHTS, w_mem});
-  args.insert({DNNL_ARG_DST, dst_mem});
-
-  prim.execute(stream, args);
-  stream.wait();
-  return dst_mem;
-}
+/**
+ * @brief bf16, f32 or int8 inner product of an (n x ic) source against
+ * (oc x ic) weights.
+ *
+ * The primitive is created once per shape. Weights are reordered once into
+ * the layout the primitive prefers and kept by the caller, so scoring a
+ * source against many weight tiles only pays for one source reorder plus
+ * one GEMM per tile. With a bias, a per-output f32 term is added in the
+ * GEMM epilogue (used for the dataset norms of L2 search).
+ *
+ * With dt::s8 both operands are int8, accumulated in s32 (AMX-INT8 or
+ * AVX512-VNNI), and dequantized in the epilogue with one common source scale
+ * and one scale per weights row: dst = s_src * s_w[oc] * acc + bias[oc].
+ *
+ * With set_profile(), weight and source reorders and GEMMs are timed into
+ * the given profile, with the bytes they move and the GEMM flops.
+ */
+class AMXInnerProduct {
+  int32_t _n;
+  int32_t _oc;
+  int32_t _ic;
+  bool _with_bias;
+  dt _data_type;
+
+  dnnl::engine &_engine;
+  dnnl::stream &_stream;
+
+  dnnl::inner_product_forward::primitive_desc _pd;
+  dnnl::inner_product_forward _prim;
+  dnnl::memory _s_mem;
+  dnnl::memory _s_scale_mem;
+  dnnl::memory _dst_mem;
+
+  PhaseProfile *_profile = nullptr;
+
+public:
+  AMXInnerProduct(int32_t n, int32_t oc, int32_t ic,
+                  dnnl::engine &engine, dnnl::stream &stream,
+                  bool with_bias = false, dt data_type = dt::bf16)
+      : _n(n), _oc(oc), _ic(ic), _with_bias(with_bias), _data_type(data_type),
+        _engine(engine), _stream(stream) {
+    dnnl::memory::dims s_dims = {_n, _ic};
+    dnnl::memory::dims w_dims = {_oc, _ic};
+    dnnl::memory::dims dst_dims = {_n, _oc};
+
+    auto s_md = dnnl::memory::desc(s_dims, _data_type, tag::any);
+    auto w_md = dnnl::memory::desc(w_dims, _data_type, tag::any);
+    auto dst_md = dnnl::memory::desc(dst_dims, dt::f32, tag::ab);
+
+    dnnl::primitive_attr attr;
+    if (_data_type == dt::s8) {
+      attr.set_scales_mask(DNNL_ARG_SRC, 0);
+      attr.set_scales_mask(DNNL_ARG_WEIGHTS, 1 << 0);
+    }
+
+    if (_with_bias) {
+      auto b_md = dnnl::memory::desc({_oc}, dt::f32, tag::a);
+      _pd = dnnl::inner_product_forward::primitive_desc(
+          _engine, dnnl::prop_kind::forward_inference, s_md, w_md, b_md, dst_md, attr);
+    } else {
+      _pd = dnnl::inner_product_forward::primitive_desc(
+          _engine, dnnl::prop_kind::forward_inference, s_md, w_md, dst_md, attr);
+    }
+    _prim = dnnl::inner_product_forward(_pd);
+
+    _s_mem = dnnl::memory(_pd.src_desc(), _engine);
+    _s_scale_mem = dnnl::memory({{1}, dt::f32, tag::a}, _engine);
+    _dst_mem = dnnl::memory(_pd.dst_desc(), _engine);
+  }
+
+  void set_profile(PhaseProfile *profile) {
+    _profile = profile;
+  }
+
+  /**
+   * @brief Convert f32 weights to the primitive's data type and packed layout.
+   *
+   * @param w Row-major (oc x ic) f32 weights, already quantized to integer
+   *          values in [-127, 127] for dt::s8
+   * @return The packed weights, to be passed back to compute()
+   */
+  dnnl::memory pack_weights(const float *w) {
+    ScopedPhase phase(_profile, Phase::DATASET_REORDER,
+                      (double)_oc * _ic * sizeof(float) + _pd.weights_desc().get_size());
+    auto w_in_md = dnnl::memory::desc({_oc, _ic}, dt::f32, tag::ab);
+    auto w_in_mem = dnnl::memory(w_in_md, _engine, const_cast<float *>(w));
+    auto w_mem = dnnl::memory(_pd.weights_desc(), _engine);
+    dnnl::reorder(w_in_mem, w_mem).execute(_stream, w_in_mem, w_mem);
+    _stream.wait();
+    return w_mem;
+  }
+
+  dnnl::memory::desc weights_desc() const { return _pd.weights_desc(); }
+
+  /**
+   * @brief Use weights that were packed earlier, possibly by another process.
+   *
+   * @param md Layout the weights were packed with
+   * @param w The packed weights, which must outlive the returned memory
+   * @return The weights wrapped without a copy when md is the layout this
+   *         primitive prefers, otherwise a reordered copy
+   */
+  dnnl::memory import_weights(const dnnl::memory::desc &md, const void *w) {
+    auto w_in_mem = dnnl::memory(md, _engine, const_cast<void *>(w));
+    if (md == _pd.weights_desc()) {
+      return w_in_mem;
+    }
+    ScopedPhase phase(_profile, Phase::DATASET_REORDER,
+                      (double)md.get_size() + _pd.weights_desc().get_size());
+    auto w_mem = dnnl::memory(_pd.weights_desc(), _engine);
+    dnnl::reorder(w_in_mem, w_mem).execute(_stream, w_in_mem, w_mem);
+    _stream.wait();
+    return w_mem;
+  }
+
+  /**
+   * @brief Copy a per-output f32 bias into a memory the primitive can use.
+   *
+   * @param b The oc bias values
+   * @return The bias, to be passed back to compute()
+   */
+  dnnl::memory pack_bias(const float *b) {
+    auto b_mem = dnnl::memory(_pd.bias_desc(), _engine);
+    std::copy(b, b + _oc, static_cast<float *>(b_mem.get_data_handle()));
+    return b_mem;
+  }
+
+  /**
+   * @brief Copy the per-row dequantization scales of int8 weights.
+   *
+   * @param scales The oc weights scales
+   * @return The scales, to be passed back to compute()
+   */
+  dnnl::memory pack_scales(const float *scales) {
+    auto s_mem = dnnl::memory({{_oc}, dt::f32, tag::a}, _engine);
+    std::copy(scales, scales + _oc, static_cast<float *>(s_mem.get_data_handle()));
+    return s_mem;
+  }
+
+  /**
+   * @brief Convert an (n x ic) f32 source to the primitive's data type for
+   * the following compute() calls.
+   *
+   * @param src Row-major (n x ic) f32 source, already quantized to integer
+   *            values in [-127, 127] for dt::s8
+   * @param scale Dequantization scale of the whole source, for dt::s8
+   */
+  void set_src(const float *src, float scale = 1.0f) {
+    ScopedPhase phase(_profile, Phase::QUERY_REORDER,
+                      (double)_n * _ic * sizeof(float) + _pd.src_desc().get_size());
+    auto s_in_md = dnnl::memory::desc({_n, _ic}, dt::f32, tag::ab);
+    auto s_in_mem = dnnl::memory(s_in_md, _engine, const_cast<float *>(src));
+    dnnl::reorder(s_in_mem, _s_mem).execute(_stream, s_in_mem, _s_mem);
+    *static_cast<float *>(_s_scale_mem.get_data_handle()) = scale;
+  }
+
+  /**
+   * @brief Read the source of another primitive instead of keeping one, so
+   * a single set_src() on owner serves both. Only possible when both chose
+   * the same source layout.
+   *
+   * @return false, with nothing shared, if the layouts differ
+   */
+  bool share_src(const AMXInnerProduct &owner) {
+    if (owner._pd.src_desc() != _pd.src_desc()) {
+      return false;
+    }
+    _s_mem = owner._s_mem;
+    _s_scale_mem = owner._s_scale_mem;
+    return true;
+  }
+
+  /**
+   * @brief Score the current source against one set of packed weights.
+   *
+   * @param w_mem Weights returned by pack_weights()
+   * @param b_mem Bias returned by pack_bias(), required iff with_bias
+   * @param w_scale_mem Scales returned by pack_scales(), required for dt::s8
+   * @return The (n x oc) f32 result, owned by this object and overwritten
+   *         by the next call
+   */
+  dnnl::memory &compute(dnnl::memory &w_mem, dnnl::memory *b_mem = nullptr,
+                        dnnl::memory *w_scale_mem = nullptr) {
+    // Bytes are the packed weights streamed by the call plus its source
+    // and scores
+    ScopedPhase phase(_profile, Phase::GEMM,
+                      (double)_pd.weights_desc().get_size() + _pd.src_desc().get_size() +
+                        _pd.dst_desc().get_size(),
+                      2.0 * _n * _oc * _ic);
+    std::unordered_map<int32_t, dnnl::memory> args;
+    args.insert({DNNL_ARG_SRC, _s_mem});
+    args.insert({DNNL_ARG_WEIGHTS, w_mem});
+    args.insert({DNNL_ARG_DST, _dst_mem});
+    if (_with_bias) {
+      args.insert({DNNL_ARG_BIAS, *b_mem});
+    }
+    if (_data_type == dt::s8) {
+      args.insert({DNNL_ARG_ATTR_SCALES | DNNL_ARG_SRC, _s_scale_mem});
+      args.insert({DNNL_ARG_ATTR_SCALES | DNNL_ARG_WEIGHTS, *w_scale_mem});
+    }
+
+    _prim.execute(_stream, args);
+    _stream.wait();
+    return _dst_mem;
+  }
+};
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <cstdint>
+#include <immintrin.h>
+
+#include "isa.hpp"
+#include "tile_kernel.hpp"
+
+/**
+ * Small-batch scoring for a handful of queries: the dataset is streamed
+ * once and every block of it is dotted with all queries while it is in
+ * registers, GEMV style. No primitive, reorder or tile setup happens per
+ * call, which is what dominates a GEMM for one to a few queries.
+ *
+ * The dataset uses the packed blocks of tile_kernel.hpp (16 rows, kp a
+ * multiple of 32), where each 64 bytes hold one pair of dimensions of all
+ * 16 rows. Broadcasting the matching pair of a query against them
+ * accumulates the 16 scores of the block lane by lane, so there is no
+ * horizontal reduce per row. With AVX512_BF16 one VDPBF16PS does a pair;
+ * plain AVX-512 widens both halves to f32 and does two FMAs. The same
+ * offset of the next blocks is prefetched, since the hardware prefetcher
+ * alone leaves a single core's scan short of its memory bandwidth.
+ *
+ * Queries are bf16 rows of kp values, so the scores match the bf16 GEMM up
+ * to summation order.
+ */
+
+// XB blocks against NQ queries, scores[g * ld + 16 * b + r]
+template <int NQ, int XB>
+__attribute__((target("avx512f,avx512bf16")))
+inline void gemv_blocks_bf16(const uint16_t *x, int32_t kp, const uint16_t *q,
+                             float *scores, int64_t ld) {
+  const int64_t x_block = (int64_t)TILE_ROWS * kp;
+  __m512 acc[NQ][XB];
+  for (int g = 0; g < NQ; g++) {
+    for (int b = 0; b < XB; b++) {
+      acc[g][b] = _mm512_setzero_ps();
+    }
+  }
+  for (int32_t p = 0; p < kp / 2; p++) {
+    __m512bh xv[XB];
+    for (int b = 0; b < XB; b++) {
+      _mm_prefetch((const char *)(x + (XB + b) * x_block + p * 2 * TILE_ROWS), _MM_HINT_T0);
+      xv[b] = (__m512bh)_mm512_loadu_si512(x + b * x_block + p * 2 * TILE_ROWS);
+    }
+    for (int g = 0; g < NQ; g++) {
+      uint32_t pair;
+      __builtin_memcpy(&pair, q + (int64_t)g * kp + 2 * p, sizeof(pair));
+      __m512bh qv = (__m512bh)_mm512_set1_epi32(pair);
+      for (int b = 0; b < XB; b++) {
+        acc[g][b] = _mm512_dpbf16_ps(acc[g][b], xv[b], qv);
+      }
+    }
+  }
+  for (int g = 0; g < NQ; g++) {
+    for (int b = 0; b < XB; b++) {
+      _mm512_storeu_ps(scores + g * ld + b * TILE_ROWS, acc[g][b]);
+    }
+  }
+}
+
+// Same with f32 FMAs for AVX-512 without BF16
+template <int NQ, int XB>
+__attribute__((target("avx512f")))
+inline void gemv_blocks_f32(const uint16_t *x, int32_t kp, const uint16_t *q,
+                            float *scores, int64_t ld) {
+  const int64_t x_block = (int64_t)TILE_ROWS * kp;
+  const __m512i high = _mm512_set1_epi32((int32_t)0xffff0000);
+  __m512 acc[NQ][XB];
+  for (int g = 0; g < NQ; g++) {
+    for (int b = 0; b < XB; b++) {
+      acc[g][b] = _mm512_setzero_ps();
+    }
+  }
+  for (int32_t p = 0; p < kp / 2; p++) {
+    __m512 even[XB], odd[XB];
+    for (int b = 0; b < XB; b++) {
+      _mm_prefetch((const char *)(x + (XB + b) * x_block + p * 2 * TILE_ROWS), _MM_HINT_T0);
+      __m512i raw = _mm512_loadu_si512(x + b * x_block + p * 2 * TILE_ROWS);
+      even[b] = _mm512_castsi512_ps(_mm512_slli_epi32(raw, 16));
+      odd[b] = _mm512_castsi512_ps(_mm512_and_si512(raw, high));
+    }
+    for (int g = 0; g < NQ; g++) {
+      const uint16_t *qp = q + (int64_t)g * kp + 2 * p;
+      __m512 qe = _mm512_set1_ps(bf16_to_f32(qp[0]));
+      __m512 qo = _mm512_set1_ps(bf16_to_f32(qp[1]));
+      for (int b = 0; b < XB; b++) {
+        acc[g][b] = _mm512_fmadd_ps(even[b], qe, acc[g][b]);
+        acc[g][b] = _mm512_fmadd_ps(odd[b], qo, acc[g][b]);
+      }
+    }
+  }
+  for (int g = 0; g < NQ; g++) {
+    for (int b = 0; b < XB; b++) {
+      _mm512_storeu_ps(scores + g * ld + b * TILE_ROWS, acc[g][b]);
+    }
+  }
+}
+
+// Portable reference of the same layout
+inline void gemv_blocks_scalar(const uint16_t *x, int32_t n_blocks, int32_t kp,
+                               const uint16_t *q, int32_t nq, float *scores, int64_t ld) {
+  for (int32_t g = 0; g < nq; g++) {
+    for (int32_t b = 0; b < n_blocks; b++) {
+      const uint16_t *xb = x + (int64_t)b * TILE_ROWS * kp;
+      float *s = scores + g * ld + b * TILE_ROWS;
+      for (int32_t r = 0; r < TILE_ROWS; r++) {
+        s[r] = 0.0f;
+      }
+      for (int32_t p = 0; p < kp / 2; p++) {
+        float qe = bf16_to_f32(q[(int64_t)g * kp + 2 * p]);
+        float qo = bf16_to_f32(q[(int64_t)g * kp + 2 * p + 1]);
+        for (int32_t r = 0; r < TILE_ROWS; r++) {
+          s[r] += bf16_to_f32(xb[p * 2 * TILE_ROWS + 2 * r]) * qe +
+                  bf16_to_f32(xb[p * 2 * TILE_ROWS + 2 * r + 1]) * qo;
+        }
+      }
+    }
+  }
+}
+
+// Two blocks per pass while they last, NQ queries at a time
+template <int NQ, bool BF16>
+inline void gemv_blocks_nq(const uint16_t *x, int32_t n_blocks, int32_t kp,
+                           const uint16_t *q, float *scores, int64_t ld) {
+  const int64_t x_block = (int64_t)TILE_ROWS * kp;
+  int32_t b = 0;
+  for (; b + 2 <= n_blocks; b += 2) {
+    if (BF16) {
+      gemv_blocks_bf16<NQ, 2>(x + b * x_block, kp, q, scores + b * TILE_ROWS, ld);
+    } else {
+      gemv_blocks_f32<NQ, 2>(x + b * x_block, kp, q, scores + b * TILE_ROWS, ld);
+    }
+  }
+  if (b < n_blocks) {
+    if (BF16) {
+      gemv_blocks_bf16<NQ, 1>(x + b * x_block, kp, q, scores + b * TILE_ROWS, ld);
+    } else {
+      gemv_blocks_f32<NQ, 1>(x + b * x_block, kp, q, scores + b * TILE_ROWS, ld);
+    }
+  }
+}
+
+/**
+ * @brief Score nq queries against packed blocks, up to eight queries per
+ * pass over the blocks.
+ *
+ * @param x n_blocks blocks of 16 rows, as tile_pack_dataset() writes them
+ * @param q Row-major (nq x kp) bf16 queries
+ * @param scores Output (nq x 16 n_blocks) scores with row stride ld
+ */
+template <bool BF16>
+inline void gemv_score_blocks(const uint16_t *x, int32_t n_blocks, int32_t kp,
+                              const uint16_t *q, int32_t nq, float *scores, int64_t ld) {
+  for (int32_t g0 = 0; g0 < nq; g0 += 8) {
+    const uint16_t *qg = q + (int64_t)g0 * kp;
+    float *sg = scores + g0 * ld;
+    switch (nq - g0 < 8 ? nq - g0 : 8) {
+      case 1: gemv_blocks_nq<1, BF16>(x, n_blocks, kp, qg, sg, ld); break;
+      case 2: gemv_blocks_nq<2, BF16>(x, n_blocks, kp, qg, sg, ld); break;
+      case 3: gemv_blocks_nq<3, BF16>(x, n_blocks, kp, qg, sg, ld); break;
+      case 4: gemv_blocks_nq<4, BF16>(x, n_blocks, kp, qg, sg, ld); break;
+      case 5: gemv_blocks_nq<5, BF16>(x, n_blocks, kp, qg, sg, ld); break;
+      case 6: gemv_blocks_nq<6, BF16>(x, n_blocks, kp, qg, sg, ld); break;
+      case 7: gemv_blocks_nq<7, BF16>(x, n_blocks, kp, qg, sg, ld); break;
+      default: gemv_blocks_nq<8, BF16>(x, n_blocks, kp, qg, sg, ld); break;
+    }
+  }
+}
+
+using gemv_score_blocks_fn = void (*)(const uint16_t *, int32_t, int32_t, const uint16_t *,
+                                      int32_t, float *, int64_t);
+
+inline gemv_score_blocks_fn select_gemv_score_blocks(Isa isa) {
+  if (isa >= Isa::AVX512_BF16) {
+    return gemv_score_blocks<true>;
+  }
+  if (isa >= Isa::AVX512F) {
+    return gemv_score_blocks<false>;
+  }
+  return gemv_blocks_scalar;
+}
+
+/**
+ * Row-major counterpart for rows gathered one by one, e.g. the neighbors of
+ * a graph node, where a row is copied whole rather than split into pairs.
+ * 16 rows go per pass, each accumulating in its own register, and one
+ * shuffle tree sums the 16 registers into the 16 lanes of one, instead of a
+ * horizontal reduce per row.
+ */
+
+// acc[i] holds row GEMV_TREE_ROW[i], so the tree puts row r in lane r
+static constexpr int32_t GEMV_TREE_ROW[16] = {0, 2, 1, 3, 8, 10, 9, 11, 4, 6, 5, 7, 12, 14, 13, 15};
+
+__attribute__((target("avx512f")))
+inline __m512 gemv_sum_tree(const __m512 *acc) {
+  __m512 t[8], u[4], w[2];
+  for (int i = 0; i < 8; i++) {
+    t[i] = _mm512_add_ps(_mm512_shuffle_f32x4(acc[i], acc[i + 8], 0x44),
+                         _mm512_shuffle_f32x4(acc[i], acc[i + 8], 0xee));
+  }
+  for (int i = 0; i < 4; i++) {
+    u[i] = _mm512_add_ps(_mm512_shuffle_f32x4(t[i], t[i + 4], 0x88),
+                         _mm512_shuffle_f32x4(t[i], t[i + 4], 0xdd));
+  }
+  for (int i = 0; i < 2; i++) {
+    w[i] = _mm512_add_ps(_mm512_shuffle_ps(u[i], u[i + 2], 0x44),
+                         _mm512_shuffle_ps(u[i], u[i + 2], 0xee));
+  }
+  return _mm512_add_ps(_mm512_shuffle_ps(w[0], w[1], 0x88), _mm512_shuffle_ps(w[0], w[1], 0xdd));
+}
+
+// n rows (a multiple of 16, row stride kp) against one query, scores[r]
+__attribute__((target("avx512f,avx512bf16")))
+inline void gemv_rows_bf16(const uint16_t *x, int32_t n, int32_t kp, const uint16_t *q,
+                           float *scores) {
+  for (int32_t r0 = 0; r0 < n; r0 += TILE_ROWS) {
+    __m512 acc[TILE_ROWS];
+    for (int i = 0; i < TILE_ROWS; i++) {
+      acc[i] = _mm512_setzero_ps();
+    }
+    for (int32_t c = 0; c < kp; c += TILE_K) {
+      __m512bh qv = (__m512bh)_mm512_loadu_si512(q + c);
+      for (int i = 0; i < TILE_ROWS; i++) {
+        const uint16_t *xr = x + (int64_t)(r0 + GEMV_TREE_ROW[i]) * kp + c;
+        acc[i] = _mm512_dpbf16_ps(acc[i], (__m512bh)_mm512_loadu_si512(xr), qv);
+      }
+    }
+    _mm512_storeu_ps(scores + r0, gemv_sum_tree(acc));
+  }
+}
+
+// Same with f32 FMAs for AVX-512 without BF16
+__attribute__((target("avx512f")))
+inline void gemv_rows_f32(const uint16_t *x, int32_t n, int32_t kp, const uint16_t *q,
+                          float *scores) {
+  for (int32_t r0 = 0; r0 < n; r0 += TILE_ROWS) {
+    __m512 acc[TILE_ROWS];
+    for (int i = 0; i < TILE_ROWS; i++) {
+      acc[i] = _mm512_setzero_ps();
+    }
+    for (int32_t c = 0; c < kp; c += 16) {
+      __m256i qraw = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(q + c));
+      __m512 qv = _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(qraw), 16));
+      for (int i = 0; i < TILE_ROWS; i++) {
+        const uint16_t *xr = x + (int64_t)(r0 + GEMV_TREE_ROW[i]) * kp + c;
+        __m256i raw = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(xr));
+        __m512 xv = _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(raw), 16));
+        acc[i] = _mm512_fmadd_ps(xv, qv, acc[i]);
+      }
+    }
+    _mm512_storeu_ps(scores + r0, gemv_sum_tree(acc));
+  }
+}
+
+inline void gemv_rows_scalar(const uint16_t *x, int32_t n, int32_t kp, const uint16_t *q,
+                             float *scores) {
+  for (int32_t r = 0; r < n; r++) {
+    float dot = 0.0f;
+    for (int32_t c = 0; c < kp; c++) {
+      dot += bf16_to_f32(x[(int64_t)r * kp + c]) * bf16_to_f32(q[c]);
+    }
+    scores[r] = dot;
+  }
+}
+
+using gemv_score_rows_fn = void (*)(const uint16_t *, int32_t, int32_t, const uint16_t *, float *);
+
+inline gemv_score_rows_fn select_gemv_score_rows(Isa isa) {
+  if (isa >= Isa::AVX512_BF16) {
+    return gemv_rows_bf16;
+  }
+  if (isa >= Isa::AVX512F) {
+    return gemv_rows_f32;
+  }
+  return gemv_rows_scalar;
+}
@@ -0,0 +1,628 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <omp.h>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bf.hpp"
+#include "gemv.hpp"
+#include "isa.hpp"
+#include "tile_kernel.hpp"
+
+/**
+ * @brief HNSW graph search whose distance evaluations are batched over
+ * whole neighbor and candidate lists.
+ *
+ * Vectors are stored as zero-padded bf16 rows. When the search expands a
+ * node, the rows of all its unvisited neighbors are gathered into one
+ * contiguous block and scored in one call of the row-major GEMV kernel of
+ * gemv.hpp, 16 rows per pass.
+ *
+ * With set_query_group(), search() runs the queries of a thread in groups
+ * of up to 16 that search in lockstep: every round expands the closest
+ * candidate of each query of the group, and with AMX-BF16 all their
+ * gathered rows are scored against the whole group, packed once as a B
+ * block, in one tile product. Each query uses only the scores of its own
+ * neighbors, so the tile does 16 times the arithmetic of the GEMV kernel
+ * for the same rows. On one Sapphire Rapids core (300K x 96, M 16, ef 64,
+ * 200 queries) groups of 16 took 29.2 ms against 19.7 ms one query at a
+ * time, so groups are off by default. The graph build always scores one
+ * query at a time.
+ *
+ * The neighbor selection heuristic gathers its candidates into one row
+ * block, also packed as B blocks, and scores every candidate pair in one
+ * full tile product (AMX, or its emulation without AMX-BF16) before the
+ * heuristic runs.
+ *
+ * The graph follows faiss IndexHNSWFlat: M links per node on the upper
+ * levels, 2M on level 0, levels drawn with multiplier 1 / ln(M), and the
+ * diversity heuristic for pruning. Nodes are inserted in parallel, with a
+ * lock per node guarding its link lists; a thread never holds two locks.
+ *
+ * Distances are "smaller is better" internally: ||q||^2 + ||x||^2 - 2<q,x>
+ * for L2 and -<q,x> for inner product and cosine (normalized at ingest).
+ */
+class HNSWSearch {
+  using Cand = std::pair<float, int32_t>;
+
+  int32_t _dim;
+  int32_t _kp;
+  int32_t _nq;
+  int32_t _nl;
+  int32_t _M;
+  int32_t _ef_construction;
+  int32_t _ef_search = 16;
+  int32_t _query_group = 1;
+  Metric _metric;
+  Isa _isa;
+  Kernel _kernel;
+
+  std::vector<uint16_t> _vectors;
+  std::vector<float> _norms;
+  std::vector<int32_t> _levels;
+
+  // Link lists stored as [count, ids...]: 2M slots per node on level 0,
+  // M per level above it
+  std::vector<int32_t> _links0;
+  std::vector<std::vector<int32_t>> _upper;
+
+  int32_t _entry = -1;
+  int32_t _max_level = -1;
+  std::vector<std::mutex> _locks;
+  std::mutex _entry_lock;
+  bool _building = false;
+  gemv_score_rows_fn _gemv;
+
+  // Per-thread buffers kept across calls, so neither the hot loop nor a
+  // search allocates. visited[node] holds the epoch of the last layer
+  // search in its high 16 bits and the queries of the group that saw the
+  // node in its low 16 bits.
+  struct Scratch {
+    std::vector<uint32_t> visited;
+    uint32_t epoch = 0;
+    std::vector<uint16_t> q;
+    std::vector<uint16_t> q_cols;
+    float q_norms[TILE_ROWS];
+    std::vector<float> q_f32;
+    std::vector<Cand> heaps[TILE_ROWS][2];
+    std::vector<Cand> found[TILE_ROWS];
+    std::vector<int32_t> ids;
+    int32_t begin[TILE_ROWS + 1];
+    int32_t first_row[TILE_ROWS + 1];
+    std::vector<uint16_t> gathered;
+    std::vector<float> gathered_scores;
+    std::vector<float> dist;
+    std::vector<uint16_t> rows;
+    std::vector<uint16_t> cols;
+    std::vector<float> scores;
+    std::vector<Cand> prune;
+    std::vector<int32_t> kept;
+    std::vector<Cand> selected;
+  };
+  std::vector<Scratch> _scratch;
+
+public:
+  HNSWSearch(int32_t dim, int32_t nq, int32_t nl, int32_t M = 32,
+             int32_t ef_construction = 40, Metric metric = Metric::INNER_PRODUCT)
+      : _dim(dim), _nq(nq), _nl(nl), _M(M), _ef_construction(ef_construction),
+        _metric(metric) {
+    _kp = tile_padded_dim(dim);
+    set_isa(detect_isa());
+  }
+
+  // Use a slower instruction set than the detected one; call before add()
+  void set_isa(Isa isa) {
+    _isa = std::min(detect_isa(), isa);
+    _kernel = _isa >= Isa::AMX_BF16 ? Kernel::AMX_TILE : Kernel::EMULATED;
+    _gemv = select_gemv_score_rows(_isa);
+  }
+
+  // Size of the candidate list of a search, at least top_k
+  void set_ef(int32_t ef) {
+    _ef_search = ef;
+  }
+
+  // Queries searched in lockstep per thread, at most 16; groups are only
+  // formed when every thread still gets one
+  void set_query_group(int32_t n) {
+    _query_group = std::min(std::max(n, 1), TILE_ROWS);
+  }
+
+  // Human readable summary of the kernels picked for this machine
+  std::string describe_dispatch() const {
+    std::string expand = _isa >= Isa::AVX512_BF16 ? "avx512 dpbf16 gemv" :
+                         _isa >= Isa::AVX512F ? "avx512 gemv" : "scalar gemv";
+    if (_kernel == Kernel::AMX_TILE && _query_group > 1) {
+      expand += ", amx tile kernel for groups of " + std::to_string(_query_group);
+    }
+    const char *prune = _kernel == Kernel::AMX_TILE ? "amx tile kernel" : "emulated tile kernel";
+    return std::string(isa_name(_isa)) + " ( expand: " + expand + ", prune: " + prune +
+           ", M: " + std::to_string(_M) + " )";
+  }
+
+  /**
+   * @brief Build the graph over the dataset.
+   *
+   * @param seed Seed of the level draw, so builds are repeatable
+   */
+  void add(const float *dataset, uint32_t seed = 12345) {
+    _vectors.assign((int64_t)_nl * _kp, 0);
+    _norms.assign(_nl, 0.0f);
+    #pragma omp parallel
+    {
+      std::vector<float> row(_dim);
+      #pragma omp for
+      for (int32_t j = 0; j < _nl; j++) {
+        std::copy(dataset + (int64_t)j * _dim, dataset + (int64_t)(j + 1) * _dim,
+                  row.begin());
+        if (_metric == Metric::COSINE) {
+          normalize(row.data(), _dim);
+        }
+        uint16_t *dst = _vectors.data() + (int64_t)j * _kp;
+        float norm = 0;
+        for (int32_t c = 0; c < _dim; c++) {
+          dst[c] = f32_to_bf16(row[c]);
+          norm += bf16_to_f32(dst[c]) * bf16_to_f32(dst[c]);
+        }
+        _norms[j] = norm;
+      }
+    }
+
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> unif(0.0, 1.0);
+    double mult = 1.0 / std::log((double)_M);
+    _levels.resize(_nl);
+    _upper.assign(_nl, std::vector<int32_t>());
+    for (int32_t j = 0; j < _nl; j++) {
+      _levels[j] = (int32_t)(-std::log(std::max(unif(gen), 1e-12)) * mult);
+      _upper[j].assign((int64_t)_levels[j] * (1 + _M), 0);
+    }
+    _links0.assign((int64_t)_nl * (1 + 2 * _M), 0);
+    _locks = std::vector<std::mutex>(_nl);
+    _entry = 0;
+    _max_level = _levels[0];
+
+    _building = true;
+    prepare_scratch();
+    #pragma omp parallel
+    {
+      Scratch &s = _scratch[omp_get_thread_num()];
+      begin_kernel();
+      #pragma omp for schedule(dynamic, 64)
+      for (int32_t j = 1; j < _nl; j++) {
+        insert(s, j);
+      }
+      end_kernel();
+    }
+    _building = false;
+  }
+
+  /**
+   * @brief Find the approximate top_k nearest dataset vectors for every
+   * query with a best-first search of ef candidates on level 0.
+   *
+   * @param queries Row-major (nq x dim) f32 queries
+   * @param top_k Number of neighbors per query
+   * @param distances Output (nq x top_k) scores, best first per query
+   * @param labels Output (nq x top_k) dataset ids, -1 when fewer are found
+   */
+  void search(std::vector<float> &queries, int32_t top_k,
+              float *distances, int64_t *labels) {
+    int32_t ef = std::max(_ef_search, top_k);
+    int32_t nt = omp_get_max_threads();
+    int32_t group = std::min(_query_group, std::max(1, _nq / nt));
+    int32_t n_groups = (_nq + group - 1) / group;
+    prepare_scratch();
+    #pragma omp parallel
+    {
+      Scratch &s = _scratch[omp_get_thread_num()];
+      begin_kernel();
+      #pragma omp for schedule(dynamic)
+      for (int32_t gi = 0; gi < n_groups; gi++) {
+        int32_t q0 = gi * group;
+        int32_t G = std::min(group, _nq - q0);
+        std::fill(s.q.begin(), s.q.end(), 0);
+        for (int32_t g = 0; g < G; g++) {
+          const float *src = queries.data() + (int64_t)(q0 + g) * _dim;
+          std::copy(src, src + _dim, s.q_f32.begin());
+          if (_metric == Metric::COSINE) {
+            normalize(s.q_f32.data(), _dim);
+          }
+          for (int32_t c = 0; c < _dim; c++) {
+            s.q[(int64_t)g * _kp + c] = f32_to_bf16(s.q_f32[c]);
+          }
+          s.q_norms[g] = squared_norm(s.q_f32.data(), _dim);
+        }
+        if (_kernel == Kernel::AMX_TILE && G > 1) {
+          std::fill(s.q_cols.begin(), s.q_cols.end(), 0);
+          for (int32_t g = 0; g < G; g++) {
+            tile_pack_column(s.q.data() + (int64_t)g * _kp, _kp, g, s.q_cols.data());
+          }
+        }
+
+        descend(s, G, s.q.data(), s.q_norms, 0, ef, s.found);
+        for (int32_t g = 0; g < G; g++) {
+          const std::vector<Cand> &found = s.found[g];
+          float *d = distances + (int64_t)(q0 + g) * top_k;
+          int64_t *l = labels + (int64_t)(q0 + g) * top_k;
+          for (int32_t n = 0; n < top_k; n++) {
+            if (n < (int32_t)found.size()) {
+              d[n] = _metric == Metric::L2 ? std::max(found[n].first, 0.0f) : -found[n].first;
+              l[n] = found[n].second;
+            } else {
+              d[n] = _metric == Metric::L2 ? std::numeric_limits<float>::infinity()
+                                           : -std::numeric_limits<float>::infinity();
+              l[n] = -1;
+            }
+          }
+        }
+      }
+      end_kernel();
+    }
+  }
+
+private:
+  int32_t max_links(int32_t level) const {
+    return level == 0 ? 2 * _M : _M;
+  }
+
+  int32_t *links(int32_t node, int32_t level) {
+    if (level == 0) {
+      return _links0.data() + (int64_t)node * (1 + 2 * _M);
+    }
+    return _upper[node].data() + (int64_t)(level - 1) * (1 + _M);
+  }
+
+  const uint16_t *row(int32_t node) const {
+    return _vectors.data() + (int64_t)node * _kp;
+  }
+
+  // One Scratch per thread of the next parallel region, allocated once
+  void prepare_scratch() {
+    int32_t nt = omp_get_max_threads();
+    if ((int32_t)_scratch.size() < nt) {
+      _scratch.resize(nt);
+    }
+    for (Scratch &s : _scratch) {
+      if ((int32_t)s.visited.size() != _nl) {
+        s.visited.assign(_nl, 0);
+        s.epoch = 0;
+        s.q.assign((int64_t)TILE_ROWS * _kp, 0);
+        s.q_cols.assign((int64_t)TILE_ROWS * _kp, 0);
+        s.q_f32.assign(_dim, 0.0f);
+      }
+    }
+  }
+
+  void begin_kernel() const {
+    if (_kernel == Kernel::AMX_TILE) {
+      tile_configure();
+    }
+  }
+
+  void end_kernel() const {
+    if (_kernel == Kernel::AMX_TILE) {
+      tile_release();
+    }
+  }
+
+  float distance(float dot, float q_norm, int32_t id) const {
+    return _metric == Metric::L2 ? q_norm + _norms[id] - 2.0f * dot : -dot;
+  }
+
+  // Start a layer search: every node counts as unvisited again
+  void next_epoch(Scratch &s) {
+    if (++s.epoch == 0x10000) {
+      std::fill(s.visited.begin(), s.visited.end(), 0);
+      s.epoch = 1;
+    }
+  }
+
+  // Mark id visited by query g of the group, false if it already was
+  bool visit(Scratch &s, int32_t id, int32_t g) {
+    uint32_t &v = s.visited[id];
+    uint32_t tag = s.epoch << 16;
+    if ((v & 0xffff0000u) != tag) {
+      v = tag;
+    }
+    uint32_t bit = 1u << g;
+    if (v & bit) {
+      return false;
+    }
+    v |= bit;
+    return true;
+  }
+
+  /**
+   * @brief Distances from each query of a group to the ids gathered for it.
+   *
+   * s.ids[s.begin[g], s.begin[g + 1]) belong to query g, row g of q (row
+   * stride kp). Their rows are copied into one row-major block, those of
+   * each query starting on a multiple of 16 rows, and scored by one tile
+   * product against the group packed in s.q_cols (AMX, G > 1) or by the
+   * GEMV kernel per query. Distances go to s.dist in the order of s.ids.
+   */
+  void score_gathered(Scratch &s, int32_t G, const uint16_t *q, const float *q_norms) {
+    int32_t n_rows = 0;
+    for (int32_t g = 0; g < G; g++) {
+      s.first_row[g] = n_rows;
+      n_rows += tile_padded_rows(s.begin[g + 1] - s.begin[g]);
+    }
+    s.first_row[G] = n_rows;
+    if ((int64_t)s.gathered.size() < (int64_t)n_rows * _kp) {
+      s.gathered.resize((int64_t)n_rows * _kp);
+    }
+    for (int32_t g = 0; g < G; g++) {
+      for (int32_t i = s.begin[g]; i < s.begin[g + 1]; i++) {
+        std::memcpy(s.gathered.data() + (int64_t)(s.first_row[g] + i - s.begin[g]) * _kp,
+                    row(s.ids[i]), _kp * sizeof(uint16_t));
+      }
+    }
+    // Score of row r for query g at r * stride + g (tile) or r (GEMV)
+    bool tile = _kernel == Kernel::AMX_TILE && G > 1;
+    int32_t stride = tile ? TILE_ROWS : 1;
+    s.gathered_scores.resize((int64_t)n_rows * stride);
+    if (tile) {
+      tile_score_amx_serial(s.gathered.data(), n_rows, s.q_cols.data(), TILE_ROWS, _kp,
+                            s.gathered_scores.data(), TILE_ROWS);
+    } else {
+      for (int32_t g = 0; g < G; g++) {
+        _gemv(s.gathered.data() + (int64_t)s.first_row[g] * _kp,
+              s.first_row[g + 1] - s.first_row[g], _kp, q + (int64_t)g * _kp,
+              s.gathered_scores.data() + s.first_row[g]);
+      }
+    }
+    s.dist.resize(s.begin[G]);
+    for (int32_t g = 0; g < G; g++) {
+      for (int32_t i = s.begin[g]; i < s.begin[g + 1]; i++) {
+        int64_t r = s.first_row[g] + i - s.begin[g];
+        float dot = s.gathered_scores[r * stride + (tile ? g : 0)];
+        s.dist[i] = distance(dot, q_norms[g], s.ids[i]);
+      }
+    }
+  }
+
+  // Distances between every pair of the n candidates, in s.scores with
+  // row stride tile_padded_rows(n), from one tile product of the gathered
+  // rows against the same rows packed as B blocks
+  void score_pairs(Scratch &s, const std::vector<Cand> &cands) {
+    int32_t n = cands.size();
+    int32_t n_pad = tile_padded_rows(n);
+    s.rows.assign((int64_t)n_pad * _kp, 0);
+    s.cols.assign((int64_t)n_pad * _kp, 0);
+    s.scores.resize((int64_t)n_pad * n_pad);
+    for (int32_t i = 0; i < n; i++) {
+      const uint16_t *r = row(cands[i].second);
+      std::memcpy(s.rows.data() + (int64_t)i * _kp, r, _kp * sizeof(uint16_t));
+      tile_pack_column(r, _kp, i % TILE_ROWS,
+                       s.cols.data() + (int64_t)(i / TILE_ROWS) * TILE_ROWS * _kp);
+    }
+    if (_kernel == Kernel::AMX_TILE) {
+      tile_score_amx_serial(s.rows.data(), n_pad, s.cols.data(), n_pad, _kp,
+                            s.scores.data(), n_pad);
+    } else {
+      tile_score_emulated_serial(s.rows.data(), n_pad, s.cols.data(), n_pad, _kp,
+                                 s.scores.data(), n_pad);
+    }
+    for (int32_t i = 0; i < n; i++) {
+      for (int32_t j = 0; j < n; j++) {
+        float &d = s.scores[(int64_t)i * n_pad + j];
+        d = distance(d, _norms[cands[i].second], cands[j].second);
+      }
+    }
+  }
+
+  /**
+   * @brief Best-first search of the G queries of a group on one level, in
+   * lockstep, each from its own entry point eps[g].
+   *
+   * Every round expands the closest candidate of each query still
+   * searching and scores all their unvisited neighbors in one
+   * score_gathered(). out[g] receives the ef closest nodes of query g,
+   * closest first.
+   */
+  void search_layer(Scratch &s, int32_t G, const uint16_t *q, const float *q_norms,
+                    const Cand *eps, int32_t ef, int32_t level, std::vector<Cand> *out) {
+    next_epoch(s);
+    for (int32_t g = 0; g < G; g++) {
+      visit(s, eps[g].second, g);
+      s.heaps[g][0].assign(1, eps[g]);
+      s.heaps[g][1].assign(1, eps[g]);
+    }
+    while (true) {
+      s.ids.clear();
+      bool searching = false;
+      for (int32_t g = 0; g < G; g++) {
+        // Candidates as a min-heap, results as a max-heap
+        std::vector<Cand> &candidates = s.heaps[g][0];
+        std::vector<Cand> &results = s.heaps[g][1];
+        s.begin[g] = s.ids.size();
+        if (candidates.empty() ||
+            ((int32_t)results.size() >= ef && candidates.front().first > results.front().first)) {
+          candidates.clear();
+          continue;
+        }
+        searching = true;
+        std::pop_heap(candidates.begin(), candidates.end(), std::greater<Cand>());
+        int32_t node = candidates.back().second;
+        candidates.pop_back();
+
+        std::unique_lock<std::mutex> lock(_locks[node], std::defer_lock);
+        if (_building) {
+          lock.lock();
+        }
+        const int32_t *l = links(node, level);
+        for (int32_t i = 0; i < l[0]; i++) {
+          int32_t id = l[1 + i];
+          if (visit(s, id, g)) {
+            s.ids.push_back(id);
+          }
+        }
+      }
+      s.begin[G] = s.ids.size();
+      if (!searching) {
+        break;
+      }
+      if (s.ids.empty()) {
+        continue;
+      }
+      score_gathered(s, G, q, q_norms);
+      for (int32_t g = 0; g < G; g++) {
+        std::vector<Cand> &candidates = s.heaps[g][0];
+        std::vector<Cand> &results = s.heaps[g][1];
+        for (int32_t i = s.begin[g]; i < s.begin[g + 1]; i++) {
+          if ((int32_t)results.size() < ef || s.dist[i] < results.front().first) {
+            candidates.push_back({s.dist[i], s.ids[i]});
+            std::push_heap(candidates.begin(), candidates.end(), std::greater<Cand>());
+            results.push_back({s.dist[i], s.ids[i]});
+            std::push_heap(results.begin(), results.end());
+            if ((int32_t)results.size() > ef) {
+              std::pop_heap(results.begin(), results.end());
+              results.pop_back();
+            }
+          }
+        }
+      }
+    }
+    for (int32_t g = 0; g < G; g++) {
+      std::vector<Cand> &results = s.heaps[g][1];
+      std::sort_heap(results.begin(), results.end());
+      out[g].assign(results.begin(), results.end());
+    }
+  }
+
+  // Distances from each query of a group to the entry point, then a greedy
+  // descent down to `level` and an ef search on it, into out[g]
+  void descend(Scratch &s, int32_t G, const uint16_t *q, const float *q_norms,
+               int32_t level, int32_t ef, std::vector<Cand> *out) {
+    int32_t entry, max_level;
+    {
+      std::lock_guard<std::mutex> lock(_entry_lock);
+      entry = _entry;
+      max_level = _max_level;
+    }
+    Cand eps[TILE_ROWS];
+    s.ids.assign(G, entry);
+    for (int32_t g = 0; g <= G; g++) {
+      s.begin[g] = g;
+    }
+    score_gathered(s, G, q, q_norms);
+    for (int32_t g = 0; g < G; g++) {
+      eps[g] = {s.dist[g], entry};
+    }
+    for (int32_t l = max_level; l > level; l--) {
+      search_layer(s, G, q, q_norms, eps, 1, l, out);
+      for (int32_t g = 0; g < G; g++) {
+        eps[g] = out[g][0];
+      }
+    }
+    search_layer(s, G, q, q_norms, eps, ef, level, out);
+  }
+
+  // Diversity heuristic: keep a candidate only if it is closer to the base
+  // than to every neighbor kept so far. cands are sorted closest first
+  void select_neighbors(Scratch &s, const std::vector<Cand> &cands, int32_t m,
+                        std::vector<Cand> &out) {
+    out.clear();
+    if (cands.size() > 1) {
+      score_pairs(s, cands);
+    }
+    int64_t ld = tile_padded_rows(cands.size());
+    s.kept.clear();
+    for (size_t i = 0; i < cands.size() && (int32_t)out.size() < m; i++) {
+      bool keep = true;
+      for (int32_t j : s.kept) {
+        if (s.scores[(int64_t)i * ld + j] < cands[i].first) {
+          keep = false;
+          break;
+        }
+      }
+      if (keep) {
+        s.kept.push_back(i);
+        out.push_back(cands[i]);
+      }
+    }
+  }
+
+  // Add node to the links of n on a level, pruning them if full
+  void connect(Scratch &s, int32_t n, int32_t node, int32_t level) {
+    std::lock_guard<std::mutex> lock(_locks[n]);
+    int32_t *l = links(n, level);
+    int32_t max = max_links(level);
+    if (l[0] < max) {
+      l[1 + l[0]++] = node;
+      return;
+    }
+    s.ids.assign(l + 1, l + 1 + l[0]);
+    s.ids.push_back(node);
+    s.begin[0] = 0;
+    s.begin[1] = s.ids.size();
+    score_gathered(s, 1, row(n), &_norms[n]);
+    s.prune.resize(s.ids.size());
+    for (size_t i = 0; i < s.ids.size(); i++) {
+      s.prune[i] = {s.dist[i], s.ids[i]};
+    }
+    std::sort(s.prune.begin(), s.prune.end());
+    select_neighbors(s, s.prune, max, s.selected);
+    l[0] = s.selected.size();
+    for (size_t i = 0; i < s.selected.size(); i++) {
+      l[1 + i] = s.selected[i].second;
+    }
+  }
+
+  void insert(Scratch &s, int32_t node) {
+    int32_t level = _levels[node];
+    const uint16_t *q = row(node);
+    float q_norm = _norms[node];
+
+    int32_t entry, max_level;
+    {
+      std::lock_guard<std::mutex> lock(_entry_lock);
+      entry = _entry;
+      max_level = _max_level;
+    }
+    s.ids.assign(1, entry);
+    s.begin[0] = 0;
+    s.begin[1] = 1;
+    score_gathered(s, 1, q, &q_norm);
+    Cand ep{s.dist[0], entry};
+    std::vector<Cand> found, selected;
+    for (int32_t l = max_level; l > level; l--) {
+      search_layer(s, 1, q, &q_norm, &ep, 1, l, &found);
+      ep = found[0];
+    }
+
+    for (int32_t l = std::min(level, max_level); l >= 0; l--) {
+      search_layer(s, 1, q, &q_norm, &ep, _ef_construction, l, &found);
+      select_neighbors(s, found, max_links(l), selected);
+      {
+        std::lock_guard<std::mutex> lock(_locks[node]);
+        int32_t *own = links(node, l);
+        own[0] = selected.size();
+        for (size_t i = 0; i < selected.size(); i++) {
+          own[1 + i] = selected[i].second;
+        }
+      }
+      for (const Cand &c : selected) {
+        connect(s, c.second, node, l);
+      }
+      ep = found[0];
+    }
+
+    if (level > max_level) {
+      std::lock_guard<std::mutex> lock(_entry_lock);
+      if (level > _max_level) {
+        _entry = node;
+        _max_level = level;
+      }
+    }
+  }
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cpuid.h>
+#include <cstdint>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Instruction sets the kernels are specialized for, slowest first
+enum class Isa {
+  SCALAR,
+  AVX2,
+  AVX512F,
+  AVX512_BF16,
+  AMX_BF16,
+};
+
+inline const char *isa_name(Isa isa) {
+  switch (isa) {
+    case Isa::AMX_BF16: return "amx_bf16";
+    case Isa::AVX512_BF16: return "avx512_bf16";
+    case Isa::AVX512F: return "avx512f";
+    case Isa::AVX2: return "avx2";
+    default: return "scalar";
+  }
+}
+
+// Map an --isa value to an Isa, false if unknown
+inline bool parse_isa(const std::string &name, Isa *isa) {
+  for (Isa i : {Isa::SCALAR, Isa::AVX2, Isa::AVX512F, Isa::AVX512_BF16, Isa::AMX_BF16}) {
+    if (name == isa_name(i)) {
+      *isa = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline uint64_t read_xcr0() {
+  uint32_t eax, edx;
+  __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((uint64_t)edx << 32) | eax;
+}
+
+// Linux only hands out the AMX tile data state to processes that ask for it
+inline bool request_amx_permission() {
+  constexpr int ARCH_REQ_XCOMP_PERM = 0x1023;
+  constexpr int XFEATURE_XTILEDATA = 18;
+  return syscall(SYS_arch_prctl, ARCH_REQ_XCOMP_PERM, XFEATURE_XTILEDATA) == 0;
+}
+
+/**
+ * @brief Detect the fastest instruction set that both the CPU and the OS
+ * support, requesting AMX permission from the kernel when needed.
+ */
+inline Isa detect_isa() {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid_count(1, 0, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE)) {
+    return Isa::SCALAR;
+  }
+  uint64_t xcr0 = read_xcr0();
+  bool ymm_state = (xcr0 & 0x6) == 0x6;
+  bool zmm_state = (xcr0 & 0xe6) == 0xe6;
+  bool tile_state = (xcr0 & 0x60000) == 0x60000;
+
+  __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+  bool avx2 = ebx & (1 << 5);
+  bool avx512f = ebx & (1 << 16);
+  bool amx_bf16 = edx & (1 << 22);
+  bool amx_tile = edx & (1 << 24);
+  __get_cpuid_count(7, 1, &eax, &ebx, &ecx, &edx);
+  bool avx512_bf16 = eax & (1 << 5);
+
+  if (avx512f && amx_bf16 && amx_tile && zmm_state && tile_state &&
+      request_amx_permission()) {
+    return Isa::AMX_BF16;
+  }
+  if (avx512f && avx512_bf16 && zmm_state) {
+    return Isa::AVX512_BF16;
+  }
+  if (avx512f && zmm_state) {
+    return Isa::AVX512F;
+  }
+  if (avx2 && ymm_state) {
+    return Isa::AVX2;
+  }
+  return Isa::SCALAR;
+}
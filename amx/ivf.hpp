@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bf.hpp"
+#include "isa.hpp"
+#include "kmeans.hpp"
+#include "tile_kernel.hpp"
+#include "topk.hpp"
+
+/**
+ * @brief Inverted-file search with batched list scans.
+ *
+ * The coarse quantizer is a BruteForceSearch over the centroids, so both
+ * the assignment of dataset vectors at add() and the probe selection of a
+ * whole query batch are one tiled GEMM plus top-k, like faiss IVFFlat with
+ * an L2 quantizer (cosine probes by angle instead).
+ *
+ * Search then inverts the (query, probed list) pairs: every list is packed
+ * once in the AMX tile layout, and all the queries that probe it are
+ * gathered into one block and scored against the whole list with a single
+ * tile kernel call. Lists are spread over threads. Each (query, probe) pair
+ * owns its own k-slot of a flat nq x nprobe x k heap arena, so no two
+ * threads touch the same heap; the nprobe partial results of a query are
+ * merged at the end.
+ *
+ * The list kernel is the native AMX tile kernel, or its portable emulation
+ * on CPUs without AMX-BF16.
+ */
+class IVFSearch {
+  int32_t _dim;
+  int32_t _nq;
+  int32_t _nl;
+  int32_t _nlist;
+  int32_t _nprobe = 32;
+  int32_t _query_block;
+  Metric _metric;
+  Isa _isa;
+  Kernel _kernel;
+
+  std::vector<float> _centroids;
+  std::unique_ptr<BruteForceSearch> _coarse;
+
+  // Dataset ids of a list, its vectors in tile_pack_dataset() layout and,
+  // for L2, their squared norms padded to the packed row count
+  struct InvertedList {
+    std::vector<int64_t> ids;
+    std::vector<uint16_t> tiles;
+    std::vector<float> bias;
+  };
+  std::vector<InvertedList> _lists;
+
+public:
+  IVFSearch(int32_t dim, int32_t nq, int32_t nl, int32_t nlist,
+            int32_t query_block = 128, Metric metric = Metric::INNER_PRODUCT)
+      : _dim(dim), _nq(nq), _nl(nl), _nlist(nlist), _metric(metric) {
+    if (nlist <= 0 || nlist > nl) {
+      throw std::runtime_error("nlist must be in [1, number of dataset vectors]");
+    }
+    _query_block = std::min(query_block, nq);
+    set_isa(detect_isa());
+  }
+
+  // Use a slower instruction set than the detected one; call before train()
+  void set_isa(Isa isa) {
+    _isa = std::min(detect_isa(), isa);
+    _kernel = _isa >= Isa::AMX_BF16 ? Kernel::AMX_TILE : Kernel::EMULATED;
+  }
+
+  void set_nprobe(int32_t nprobe) {
+    _nprobe = std::min(nprobe, _nlist);
+  }
+
+  int32_t nlist() const { return _nlist; }
+
+  // Human readable summary of the kernels picked for this machine
+  std::string describe_dispatch() const {
+    const char *lists = _kernel == Kernel::AMX_TILE ? "amx tile kernel" : "emulated tile kernel";
+    const char *topk = _isa >= Isa::AVX512F ? "avx512" : (_isa >= Isa::AVX2 ? "avx2" : "scalar");
+    return std::string(isa_name(_isa)) + " ( lists: " + lists + ", top-k: " + topk + " )";
+  }
+
+  /**
+   * @brief Train nlist centroids with kmeans_train(); spherical for cosine.
+   */
+  void train(const float *dataset, KMeansParams params = KMeansParams()) {
+    params.spherical = _metric == Metric::COSINE;
+    params.query_block = std::min(params.query_block, _query_block);
+    set_centroids(kmeans_train(dataset, _nl, _dim, _nlist, params, _isa));
+  }
+
+  // Use (nlist x dim) centroids trained elsewhere
+  void set_centroids(std::vector<float> centroids) {
+    if ((int64_t)centroids.size() != (int64_t)_nlist * _dim) {
+      throw std::runtime_error("Centroids do not match nlist x dim");
+    }
+    _centroids = std::move(centroids);
+    _coarse = std::make_unique<BruteForceSearch>(
+      _dim, _nq, _nlist, 4096, _query_block, coarse_metric());
+    _coarse->set_isa(_isa);
+    _coarse->add(_centroids);
+  }
+
+  const std::vector<float> &centroids() const { return _centroids; }
+
+  /**
+   * @brief Assign every dataset vector to its nearest centroid and pack the
+   * inverted lists. Must follow train() or set_centroids().
+   */
+  void add(const float *dataset) {
+    if (_centroids.empty()) {
+      throw std::runtime_error("IVF index is not trained");
+    }
+    BruteForceSearch assign(_dim, _nl, _nlist, 4096, _query_block, coarse_metric());
+    assign.set_isa(_isa);
+    assign.add(_centroids);
+    std::vector<float> assign_dis(_nl);
+    std::vector<int64_t> assign_list(_nl);
+    assign.search(dataset, 1, assign_dis.data(), assign_list.data());
+
+    _lists.assign(_nlist, InvertedList());
+    for (int64_t j = 0; j < _nl; j++) {
+      _lists[assign_list[j]].ids.push_back(j);
+    }
+
+    int32_t kp = tile_padded_dim(_dim);
+    #pragma omp parallel
+    {
+      std::vector<float> rows;
+      #pragma omp for schedule(dynamic)
+      for (int32_t l = 0; l < _nlist; l++) {
+        InvertedList &list = _lists[l];
+        int32_t n = list.ids.size();
+        rows.resize((int64_t)n * _dim);
+        if (_metric == Metric::L2) {
+          list.bias.assign(tile_padded_rows(n), 0.0f);
+        }
+        for (int32_t j = 0; j < n; j++) {
+          const float *src = dataset + list.ids[j] * _dim;
+          if (_metric == Metric::L2) {
+            list.bias[j] = squared_norm(src, _dim);
+          }
+          transform_vector(_metric, src, rows.data() + (int64_t)j * _dim, _dim);
+        }
+        list.tiles.assign((int64_t)tile_padded_rows(n) * kp, 0);
+        tile_pack_dataset(rows.data(), n, _dim, list.tiles.data());
+      }
+    }
+  }
+
+  /**
+   * @brief Find the approximate top_k nearest dataset vectors for every
+   * query among the nprobe closest lists.
+   *
+   * @param queries Row-major (nq x dim) f32 queries
+   * @param top_k Number of neighbors per query
+   * @param distances Output (nq x top_k) scores, best first per query
+   * @param labels Output (nq x top_k) dataset ids, -1 when fewer are found
+   */
+  void search(std::vector<float> &queries, int32_t top_k,
+              float *distances, int64_t *labels) {
+    if (keep_largest(_metric)) {
+      search_impl<true>(queries, top_k, distances, labels);
+    } else {
+      search_impl<false>(queries, top_k, distances, labels);
+    }
+  }
+
+private:
+  Metric coarse_metric() const {
+    return _metric == Metric::COSINE ? Metric::COSINE : Metric::L2;
+  }
+
+  template <bool KeepLargest>
+  void search_impl(std::vector<float> &queries, int32_t top_k,
+                   float *out_dis, int64_t *out_ids) {
+    int32_t np = _nprobe;
+    int32_t k = top_k;
+    std::vector<float> probe_dis((int64_t)_nq * np);
+    std::vector<int64_t> probes((int64_t)_nq * np);
+    _coarse->search(queries, np, probe_dis.data(), probes.data());
+
+    // Invert the (query, probe) slots into per-list slot lists
+    std::vector<int64_t> offsets(_nlist + 1, 0);
+    for (int64_t s = 0; s < (int64_t)_nq * np; s++) {
+      if (probes[s] >= 0) {
+        offsets[probes[s] + 1]++;
+      }
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    std::vector<int64_t> slots(offsets[_nlist]);
+    std::vector<int64_t> fill(offsets.begin(), offsets.end() - 1);
+    for (int64_t s = 0; s < (int64_t)_nq * np; s++) {
+      if (probes[s] >= 0) {
+        slots[fill[probes[s]]++] = s;
+      }
+    }
+
+    // Queries are packed once; a list block just copies their bf16 rows
+    int32_t kp = tile_padded_dim(_dim);
+    std::vector<float> q_buf;
+    const float *q = queries.data();
+    if (_metric == Metric::COSINE) {
+      q_buf.assign(queries.begin(), queries.begin() + (int64_t)_nq * _dim);
+      for (int32_t i = 0; i < _nq; i++) {
+        normalize(q_buf.data() + (int64_t)i * _dim, _dim);
+      }
+      q = q_buf.data();
+    }
+    std::vector<uint16_t> q_packed((int64_t)tile_padded_rows(_nq) * kp);
+    tile_pack_queries(q, _nq, _dim, q_packed.data());
+
+    // Partial top-k per (query, probe) slot, holding positions in the list
+    std::vector<float> part_dis((int64_t)_nq * np * k);
+    std::vector<int64_t> part_pos((int64_t)_nq * np * k);
+    #pragma omp parallel for
+    for (int64_t s = 0; s < (int64_t)_nq * np; s++) {
+      heap_init<KeepLargest>(part_dis.data() + s * k, part_pos.data() + s * k, k);
+    }
+
+    auto add_row = select_heap_add_row<KeepLargest>(_isa);
+    bool amx = _kernel == Kernel::AMX_TILE;
+    auto score = amx ? tile_score_amx_serial : tile_score_emulated_serial;
+    int32_t qb_pad = tile_padded_rows(_query_block);
+
+    #pragma omp parallel
+    {
+      if (amx) {
+        tile_configure();
+      }
+      std::vector<uint16_t> q_block((int64_t)qb_pad * kp);
+      std::vector<float> scores;
+      #pragma omp for schedule(dynamic)
+      for (int32_t l = 0; l < _nlist; l++) {
+        const InvertedList &list = _lists[l];
+        int32_t n = list.ids.size();
+        if (n == 0) {
+          continue;
+        }
+        int32_t n_pad = tile_padded_rows(n);
+        scores.resize((int64_t)qb_pad * n_pad);
+        const float *bias = list.bias.empty() ? nullptr : list.bias.data();
+        for (int64_t b = offsets[l]; b < offsets[l + 1]; b += _query_block) {
+          int32_t rows = std::min<int64_t>(_query_block, offsets[l + 1] - b);
+          int32_t rows_pad = tile_padded_rows(rows);
+          for (int32_t r = 0; r < rows; r++) {
+            int64_t query = slots[b + r] / np;
+            std::memcpy(q_block.data() + (int64_t)r * kp, q_packed.data() + query * kp,
+                        kp * sizeof(uint16_t));
+          }
+          std::fill(q_block.begin() + (int64_t)rows * kp,
+                    q_block.begin() + (int64_t)rows_pad * kp, 0);
+          score(q_block.data(), rows_pad, list.tiles.data(), n_pad, kp,
+                scores.data(), n_pad, bias);
+          for (int32_t r = 0; r < rows; r++) {
+            int64_t offset = slots[b + r] * k;
+            add_row(part_dis.data() + offset, part_pos.data() + offset, k,
+                    scores.data() + (int64_t)r * n_pad, n, 0);
+          }
+        }
+      }
+      if (amx) {
+        tile_release();
+      }
+    }
+
+    #pragma omp parallel for
+    for (int32_t i = 0; i < _nq; i++) {
+      float *d = out_dis + (int64_t)i * top_k;
+      int64_t *ids = out_ids + (int64_t)i * top_k;
+      heap_init<KeepLargest>(d, ids, top_k);
+      for (int32_t p = 0; p < np; p++) {
+        int64_t s = (int64_t)i * np + p;
+        if (probes[s] < 0) {
+          continue;
+        }
+        const InvertedList &list = _lists[probes[s]];
+        for (int32_t n = 0; n < k; n++) {
+          int64_t pos = part_pos[s * k + n];
+          float dis = part_dis[s * k + n];
+          if (pos >= 0 && heap_better<KeepLargest>(dis, d[0])) {
+            heap_replace_top<KeepLargest>(d, ids, top_k, dis, list.ids[pos]);
+          }
+        }
+      }
+      heap_sort<KeepLargest>(d, ids, top_k);
+      if (_metric == Metric::L2) {
+        float q_norm = squared_norm(queries.data() + (int64_t)i * _dim, _dim);
+        for (int32_t n = 0; n < top_k; n++) {
+          d[n] = std::max(d[n] + q_norm, 0.0f);
+        }
+      }
+    }
+  }
+};
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <numeric>
+#include <omp.h>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "bf.hpp"
+
+struct KMeansParams {
+  // Train on at most this many sampled vectors (0 uses all of them)
+  int64_t max_samples = 0;
+  int32_t iterations = 25;
+  uint32_t seed = 1234;
+  // Keep centroids on the unit sphere, for cosine
+  bool spherical = false;
+  // GEMM blocking of the assignment step
+  int32_t tile_rows = 4096;
+  int32_t query_block = 128;
+  bool verbose = false;
+};
+
+/**
+ * @brief Lloyd's k-means whose assignment step is the AMX brute-force
+ * search: each iteration packs the centroids as one L2 BruteForceSearch
+ * and assigns every sample with a top-1 search, i.e. a blocked bf16 GEMM
+ * plus argmax. The update step averages the samples of each centroid. As
+ * in faiss, an empty centroid is re-seeded by splitting a cluster picked
+ * with probability proportional to its size.
+ *
+ * @param data Row-major (n x dim) training vectors
+ * @return Row-major (k x dim) centroids
+ */
+inline std::vector<float> kmeans_train(const float *data, int64_t n, int32_t dim,
+                                       int32_t k, const KMeansParams &params,
+                                       Isa isa = detect_isa()) {
+  if (k <= 0 || k > n) {
+    throw std::runtime_error("k-means needs 1 <= k <= number of vectors");
+  }
+  std::mt19937 gen(params.seed);
+
+  // Sample without replacement; the first k samples seed the centroids
+  int64_t n_sample = params.max_samples > 0 ? std::min(params.max_samples, n) : n;
+  n_sample = std::max<int64_t>(n_sample, k);
+  std::vector<int64_t> perm(n);
+  std::iota(perm.begin(), perm.end(), 0);
+  for (int64_t i = 0; i < n_sample; i++) {
+    std::uniform_int_distribution<int64_t> pick(i, n - 1);
+    std::swap(perm[i], perm[pick(gen)]);
+  }
+  std::vector<float> sample(n_sample * dim);
+  #pragma omp parallel for
+  for (int64_t i = 0; i < n_sample; i++) {
+    std::copy(data + perm[i] * dim, data + (perm[i] + 1) * dim, sample.data() + i * dim);
+    if (params.spherical) {
+      normalize(sample.data() + i * dim, dim);
+    }
+  }
+  std::vector<float> centroids(sample.begin(), sample.begin() + (int64_t)k * dim);
+  // As in faiss, k samples are their own centroids; there would be no
+  // cluster of two or more to split into an empty one
+  if (n_sample == k) {
+    return centroids;
+  }
+
+  BruteForceSearch assign(dim, n_sample, k, params.tile_rows, params.query_block, Metric::L2);
+  assign.set_isa(isa);
+  std::vector<float> assign_dis(n_sample);
+  std::vector<int64_t> assign_id(n_sample);
+  std::vector<int64_t> counts(k);
+
+  for (int32_t it = 0; it < params.iterations; it++) {
+    assign.add(centroids);
+    assign.search(sample, 1, assign_dis.data(), assign_id.data());
+
+    // Every thread owns a contiguous range of centroids and scans all
+    // assignments, so the sums need no atomics or per-thread copies
+    std::fill(counts.begin(), counts.end(), 0);
+    #pragma omp parallel
+    {
+      int nt = omp_get_num_threads();
+      int rank = omp_get_thread_num();
+      int64_t c0 = (int64_t)k * rank / nt;
+      int64_t c1 = (int64_t)k * (rank + 1) / nt;
+      std::fill(centroids.begin() + c0 * dim, centroids.begin() + c1 * dim, 0.0f);
+      for (int64_t i = 0; i < n_sample; i++) {
+        int64_t c = assign_id[i];
+        if (c >= c0 && c < c1) {
+          counts[c]++;
+          const float *x = sample.data() + i * dim;
+          float *dst = centroids.data() + c * dim;
+          for (int32_t d = 0; d < dim; d++) {
+            dst[d] += x[d];
+          }
+        }
+      }
+      for (int64_t c = c0; c < c1; c++) {
+        if (counts[c] > 0) {
+          float *dst = centroids.data() + c * dim;
+          for (int32_t d = 0; d < dim; d++) {
+            dst[d] /= counts[c];
+          }
+        }
+      }
+    }
+
+    // Split a populated cluster into each empty one, nudging the two
+    // copies apart so they do not stay identical
+    int64_t n_split = 0;
+    for (int32_t c = 0; c < k; c++) {
+      if (counts[c] > 0) {
+        continue;
+      }
+      std::uniform_real_distribution<float> coin(0.0f, 1.0f);
+      int32_t big = 0;
+      do {
+        big = std::uniform_int_distribution<int32_t>(0, k - 1)(gen);
+      } while (coin(gen) >= (counts[big] - 1.0f) / (n_sample - k));
+      float *src = centroids.data() + (int64_t)big * dim;
+      float *dst = centroids.data() + (int64_t)c * dim;
+      for (int32_t d = 0; d < dim; d++) {
+        float eps = (d % 2 == 0) ? 1.0f / 1024 : -1.0f / 1024;
+        dst[d] = src[d] * (1 + eps);
+        src[d] = src[d] * (1 - eps);
+      }
+      counts[c] = counts[big] / 2;
+      counts[big] -= counts[c];
+      n_split++;
+    }
+
+    if (params.spherical) {
+      #pragma omp parallel for
+      for (int32_t c = 0; c < k; c++) {
+        normalize(centroids.data() + (int64_t)c * dim, dim);
+      }
+    }
+
+    if (params.verbose) {
+      double objective = 0;
+      for (int64_t i = 0; i < n_sample; i++) {
+        objective += assign_dis[i];
+      }
+      std::cout << "[INFO] k-means iteration " << it << ": objective " << objective
+                << ", split " << n_split << " empty clusters" << std::endl;
+    }
+  }
+  return centroids;
+}
@@ -0,0 +1,350 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <numa.h>
+#include <omp.h>
+#include <sched.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bf.hpp"
+#include "topk.hpp"
+
+/**
+ * @brief The NUMA nodes this process may run on, with the CPUs of each that
+ * are in its affinity mask. A single node holding every allowed CPU when
+ * libnuma reports no NUMA support.
+ */
+struct NumaNode {
+  int32_t id;
+  std::vector<int32_t> cpus;
+};
+
+inline std::vector<NumaNode> numa_nodes() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+
+  std::vector<NumaNode> nodes;
+  if (numa_available() < 0) {
+    NumaNode node{0, {}};
+    for (int32_t c = 0; c < CPU_SETSIZE; c++) {
+      if (CPU_ISSET(c, &allowed)) {
+        node.cpus.push_back(c);
+      }
+    }
+    nodes.push_back(node);
+    return nodes;
+  }
+
+  struct bitmask *mask = numa_allocate_cpumask();
+  for (int32_t n = 0; n <= numa_max_node(); n++) {
+    if (!numa_bitmask_isbitset(numa_all_nodes_ptr, n) || numa_node_to_cpus(n, mask) < 0) {
+      continue;
+    }
+    NumaNode node{n, {}};
+    for (int32_t c = 0; c < (int32_t)mask->size && c < CPU_SETSIZE; c++) {
+      if (numa_bitmask_isbitset(mask, c) && CPU_ISSET(c, &allowed)) {
+        node.cpus.push_back(c);
+      }
+    }
+    if (!node.cpus.empty()) {
+      nodes.push_back(node);
+    }
+  }
+  numa_free_cpumask(mask);
+  return nodes;
+}
+
+// Pin the calling thread (and the OpenMP team it starts later) to the CPUs
+// of a node and size that team to them
+inline void numa_bind_thread(const NumaNode &node) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int32_t c : node.cpus) {
+    CPU_SET(c, &set);
+  }
+  sched_setaffinity(0, sizeof(set), &set);
+  if (numa_available() >= 0) {
+    numa_set_localalloc();
+  }
+  omp_set_num_threads(node.cpus.size());
+}
+
+/**
+ * @brief A thread pinned to one NUMA node that runs the jobs posted to it,
+ * one at a time, until destroyed. The thread and the OpenMP team it starts
+ * for its first job are reused by every later job.
+ */
+class NodeWorker {
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::function<void()> _job;
+  bool _busy = false;
+  bool _stop = false;
+  std::exception_ptr _error;
+  std::thread _thread;
+
+public:
+  explicit NodeWorker(const NumaNode &node) : _thread([this, node]() { loop(node); }) {}
+
+  ~NodeWorker() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _cv.notify_all();
+    _thread.join();
+  }
+
+  // Start job on the worker; wait() before posting the next one
+  void post(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _job = std::move(job);
+      _busy = true;
+    }
+    _cv.notify_all();
+  }
+
+  // Block until the posted job is done, rethrowing what it threw
+  void wait() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait(lock, [this]() { return !_busy; });
+    if (_error) {
+      std::exception_ptr error = _error;
+      _error = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+
+private:
+  void loop(NumaNode node) {
+    numa_bind_thread(node);
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+      _cv.wait(lock, [this]() { return _job || _stop; });
+      if (!_job) {
+        return;
+      }
+      std::function<void()> job = std::move(_job);
+      _job = nullptr;
+      lock.unlock();
+      std::exception_ptr error;
+      try {
+        job();
+      } catch (...) {
+        error = std::current_exception();
+      }
+      lock.lock();
+      _error = error;
+      _busy = false;
+      _cv.notify_all();
+    }
+  }
+};
+
+/**
+ * @brief Exact search with the dataset split into one contiguous shard per
+ * NUMA node.
+ *
+ * Every shard is a BruteForceSearch of its own, with its own oneDNN engine
+ * and stream, and a NodeWorker pinned to its node for the life of the
+ * index. The worker converts and packs the shard straight from the
+ * caller's dataset, so first touch places the tiles in that node's memory,
+ * and its OpenMP team searches it, so no thread streams tiles across the
+ * socket interconnect. Reusing the workers keeps thread and team startup
+ * out of the search latency, which matters for batches of a few queries.
+ * Shards get rows in proportion to the CPUs of their node.
+ *
+ * All nodes score the whole query batch concurrently. Each returns its own
+ * sorted top-k, and the per-node results of a query are merged into the
+ * final top-k on the calling thread's node.
+ */
+class NumaSearch {
+  int32_t _dim;
+  int32_t _nq;
+  int32_t _nl;
+  int32_t _tile_rows;
+  int32_t _query_block;
+  Metric _metric;
+  Isa _isa;
+  int32_t _small_batch_threshold = SMALL_BATCH_THRESHOLD;
+  Parallelism _parallelism = Parallelism::AUTO;
+
+  struct Shard {
+    NumaNode node;
+    int64_t base;
+    int32_t rows;
+    std::unique_ptr<BruteForceSearch> search;
+    std::unique_ptr<NodeWorker> worker;
+    double seconds = 0;
+  };
+  std::vector<Shard> _shards;
+
+public:
+  // Time, rows and bytes scanned by one node in the last search()
+  struct NodeStats {
+    int32_t node;
+    int32_t threads;
+    int32_t rows;
+    double seconds;
+    double bytes;
+  };
+
+  NumaSearch(int32_t dim, int32_t nq, int32_t nl, int32_t tile_rows = 4096,
+             int32_t query_block = 128, Metric metric = Metric::INNER_PRODUCT)
+      : _dim(dim), _nq(nq), _nl(nl), _tile_rows(tile_rows),
+        _query_block(query_block), _metric(metric), _isa(detect_isa()) {}
+
+  // Same as BruteForceSearch::set_isa(); call before add()
+  void set_isa(Isa isa) {
+    _isa = std::min(_isa, isa);
+  }
+
+  void set_small_batch_threshold(int32_t nq) {
+    _small_batch_threshold = nq;
+  }
+
+  void set_parallelism(Parallelism parallelism) {
+    _parallelism = parallelism;
+  }
+
+  int32_t num_nodes() const { return _shards.size(); }
+
+  // Human readable summary of the nodes and of the kernels of one shard
+  std::string describe_dispatch() const {
+    std::string nodes;
+    for (const Shard &shard : _shards) {
+      nodes += (nodes.empty() ? "" : ", ") + std::to_string(shard.node.id) + ":" +
+               std::to_string(shard.node.cpus.size());
+    }
+    return std::to_string(_shards.size()) + " numa nodes ( node:threads " + nodes + " ) " +
+           (_shards.empty() ? std::string() : _shards[0].search->describe_dispatch());
+  }
+
+  /**
+   * @brief Split the dataset over the NUMA nodes and build every shard on
+   * its own node. The dataset itself is not kept.
+   */
+  void add(const float *dataset) {
+    std::vector<NumaNode> nodes = numa_nodes();
+    int64_t cpus = 0;
+    for (const NumaNode &node : nodes) {
+      cpus += node.cpus.size();
+    }
+
+    _shards.clear();
+    int64_t base = 0;
+    int64_t cpus_before = 0;
+    for (const NumaNode &node : nodes) {
+      cpus_before += node.cpus.size();
+      int64_t end = _nl * cpus_before / cpus;
+      if (end > base) {
+        _shards.push_back(Shard{node, base, (int32_t)(end - base), nullptr,
+                                std::make_unique<NodeWorker>(node)});
+      }
+      base = end;
+    }
+
+    run_on_nodes([&](Shard &shard) {
+      shard.search = std::make_unique<BruteForceSearch>(
+        _dim, _nq, shard.rows, _tile_rows, _query_block, _metric);
+      shard.search->set_isa(_isa);
+      shard.search->set_small_batch_threshold(_small_batch_threshold);
+      shard.search->set_parallelism(_parallelism);
+      shard.search->add(dataset + shard.base * _dim);
+    });
+  }
+
+  /**
+   * @brief Search all shards concurrently and merge their results.
+   *
+   * @param queries Row-major (nq x dim) f32 queries
+   * @param top_k Number of neighbors per query
+   * @param distances Output (nq x top_k) scores, best first per query
+   * @param labels Output (nq x top_k) dataset ids
+   */
+  void search(std::vector<float> &queries, int32_t top_k,
+              float *distances, int64_t *labels) {
+    int32_t ns = _shards.size();
+    std::vector<float> part_dis((int64_t)ns * _nq * top_k);
+    std::vector<int64_t> part_ids((int64_t)ns * _nq * top_k);
+    run_on_nodes([&](Shard &shard) {
+      int64_t offset = (int64_t)(&shard - _shards.data()) * _nq * top_k;
+      auto s = std::chrono::high_resolution_clock::now();
+      shard.search->search(queries, top_k, part_dis.data() + offset, part_ids.data() + offset);
+      auto e = std::chrono::high_resolution_clock::now();
+      shard.seconds = std::chrono::duration<double>(e - s).count();
+    });
+
+    if (keep_largest(_metric)) {
+      merge<true>(part_dis, part_ids, top_k, distances, labels);
+    } else {
+      merge<false>(part_dis, part_ids, top_k, distances, labels);
+    }
+  }
+
+  // Per node statistics of the last search(); bytes count the bf16 (or
+  // f32 without bf16 support) dataset rows each node streamed once
+  std::vector<NodeStats> node_stats() const {
+    int32_t bytes_per_value = _isa >= Isa::AVX512_BF16 ? 2 : 4;
+    std::vector<NodeStats> stats;
+    for (const Shard &shard : _shards) {
+      stats.push_back(NodeStats{shard.node.id, (int32_t)shard.node.cpus.size(), shard.rows,
+                                shard.seconds, (double)shard.rows * _dim * bytes_per_value});
+    }
+    return stats;
+  }
+
+private:
+  // Run fn(shard) for every shard on the shard's worker, all at once
+  template <typename Fn>
+  void run_on_nodes(Fn fn) {
+    for (Shard &shard : _shards) {
+      shard.worker->post([&fn, &shard]() { fn(shard); });
+    }
+    // Every job references fn, so wait for all before rethrowing
+    std::exception_ptr error;
+    for (Shard &shard : _shards) {
+      try {
+        shard.worker->wait();
+      } catch (...) {
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  template <bool KeepLargest>
+  void merge(const std::vector<float> &part_dis, const std::vector<int64_t> &part_ids,
+             int32_t top_k, float *out_dis, int64_t *out_ids) {
+    #pragma omp parallel for
+    for (int32_t i = 0; i < _nq; i++) {
+      float *d = out_dis + (int64_t)i * top_k;
+      int64_t *l = out_ids + (int64_t)i * top_k;
+      heap_init<KeepLargest>(d, l, top_k);
+      for (size_t s = 0; s < _shards.size(); s++) {
+        int64_t offset = ((int64_t)s * _nq + i) * top_k;
+        for (int32_t n = 0; n < top_k; n++) {
+          int64_t id = part_ids[offset + n];
+          if (id >= 0 && heap_better<KeepLargest>(part_dis[offset + n], d[0])) {
+            heap_replace_top<KeepLargest>(d, l, top_k, part_dis[offset + n], _shards[s].base + id);
+          }
+        }
+      }
+      heap_sort<KeepLargest>(d, l, top_k);
+    }
+  }
+};
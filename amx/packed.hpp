@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * On-disk layout of a dataset already converted to bf16 (f32 when written on
+ * a machine without bf16 support) and packed into the oneDNN weights layout,
+ * one tile at a time:
+ *
+ *   PackedHeader
+ *   full tile weights memory desc blob
+ *   trailing tile weights memory desc blob (if nl % tile_rows != 0)
+ *   tiles, each starting on a page boundary
+ *   squared dataset norms, nl floats (L2 only)
+ *
+ * The tiles are byte-for-byte what the primitive consumes, so they can be
+ * mapped straight into the search engine.
+ */
+struct PackedHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t metric;
+  int64_t n;
+  int64_t dim;
+  int64_t tile_rows;
+  int64_t query_block;
+  int64_t full_desc_size;
+  int64_t tail_desc_size;
+  int64_t full_tile_bytes;
+  int64_t tail_tile_bytes;
+  int64_t tiles_offset;
+  int64_t norms_offset;
+};
+
+static constexpr char PACKED_MAGIC[8] = {'A', 'M', 'X', 'P', 'A', 'C', 'K', '\0'};
+static constexpr uint32_t PACKED_VERSION = 1;
+static constexpr int64_t PACKED_ALIGN = 4096;
+
+inline int64_t packed_align_up(int64_t x) {
+  return (x + PACKED_ALIGN - 1) / PACKED_ALIGN * PACKED_ALIGN;
+}
+
+/**
+ * @brief Read-only private mapping of a whole file, unmapped on destruction.
+ */
+class MappedFile {
+  void *_addr = nullptr;
+  size_t _size = 0;
+
+public:
+  explicit MappedFile(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Could not open " + path);
+    }
+    struct stat st;
+    fstat(fd, &st);
+    _size = st.st_size;
+    _addr = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (_addr == MAP_FAILED) {
+      _addr = nullptr;
+      throw std::runtime_error("Could not mmap " + path);
+    }
+    // Start readahead now, but leave page faults to the first search
+    madvise(_addr, _size, MADV_WILLNEED);
+  }
+
+  ~MappedFile() {
+    if (_addr) {
+      munmap(_addr, _size);
+    }
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const uint8_t *data() const { return static_cast<const uint8_t *>(_addr); }
+  size_t size() const { return _size; }
+};
+
+/**
+ * @brief Validate and return the header of a packed dataset file.
+ */
+inline PackedHeader read_packed_header(const MappedFile &file) {
+  PackedHeader h;
+  if (file.size() < sizeof(h)) {
+    throw std::runtime_error("Packed dataset file is truncated");
+  }
+  std::memcpy(&h, file.data(), sizeof(h));
+  if (std::memcmp(h.magic, PACKED_MAGIC, sizeof(PACKED_MAGIC)) != 0 ||
+      h.version != PACKED_VERSION) {
+    throw std::runtime_error("Not a packed dataset file of a supported version");
+  }
+  return h;
+}
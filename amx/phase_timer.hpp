@@ -0,0 +1,128 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+// Build with -DAMX_PHASE_TIMERS=0 to compile the phase timers out
+#ifndef AMX_PHASE_TIMERS
+#define AMX_PHASE_TIMERS 1
+#endif
+
+/**
+ * @brief Stages of building and searching a BruteForceSearch, in pipeline
+ * order. The ones from QUERY_PREP on belong to a search.
+ */
+enum class Phase {
+  PRIMITIVE_CREATE,  // oneDNN inner product primitives
+  DATASET_REORDER,   // f32 dataset tiles to the GEMM's packed layout
+  QUERY_PREP,        // query block padding, normalization and quantization
+  QUERY_REORDER,     // f32 query block to the GEMM's source layout
+  GEMM,              // scoring a query block against one tile
+  SELECT,            // top-k selection over a scored tile
+  MERGE,             // shard merge, rerank and sorting of the results
+  COUNT
+};
+
+inline const char *phase_name(Phase phase) {
+  switch (phase) {
+    case Phase::PRIMITIVE_CREATE: return "primitive create";
+    case Phase::DATASET_REORDER: return "dataset reorder";
+    case Phase::QUERY_PREP: return "query prep";
+    case Phase::QUERY_REORDER: return "query reorder";
+    case Phase::GEMM: return "gemm";
+    case Phase::SELECT: return "select";
+    case Phase::MERGE: return "merge";
+    default: return "?";
+  }
+}
+
+/**
+ * @brief Time, bytes moved and flops accumulated per phase. Not thread
+ * safe: phases are recorded by the thread driving the pipeline, around
+ * the parallel regions rather than inside them.
+ */
+class PhaseProfile {
+  struct Totals {
+    int64_t calls = 0;
+    double seconds = 0;
+    double bytes = 0;
+    double flops = 0;
+  };
+  Totals _totals[(int)Phase::COUNT];
+
+public:
+  void add(Phase phase, double seconds, double bytes, double flops) {
+    Totals &t = _totals[(int)phase];
+    t.calls++;
+    t.seconds += seconds;
+    t.bytes += bytes;
+    t.flops += flops;
+  }
+
+  // Clear the phases from `first` on
+  void reset(Phase first = Phase::PRIMITIVE_CREATE) {
+    for (int p = (int)first; p < (int)Phase::COUNT; p++) {
+      _totals[p] = Totals{};
+    }
+  }
+
+  double seconds(Phase phase) const { return _totals[(int)phase].seconds; }
+
+  // One line per phase that ran, with GB/s where bytes were counted and
+  // GFLOP/s where flops were
+  void print(const std::string &index_name) const {
+    for (int p = 0; p < (int)Phase::COUNT; p++) {
+      const Totals &t = _totals[p];
+      if (t.calls == 0) {
+        continue;
+      }
+      std::cout << "[INFO] Phase: [ index: " << index_name << " ][ " << phase_name((Phase)p)
+                << " ][ calls: " << t.calls << " ]: " << t.seconds * 1e6 << " us";
+      if (t.bytes > 0 && t.seconds > 0) {
+        std::cout << ", " << t.bytes / t.seconds / 1e9 << " GB/s";
+      }
+      if (t.flops > 0 && t.seconds > 0) {
+        std::cout << ", " << t.flops / t.seconds / 1e9 << " GFLOP/s";
+      }
+      std::cout << std::endl;
+    }
+  }
+};
+
+/**
+ * @brief Adds the time from construction to destruction to one phase of a
+ * profile, if there is one. With AMX_PHASE_TIMERS=0 this is an empty
+ * object and the clock is never read.
+ */
+class ScopedPhase {
+#if AMX_PHASE_TIMERS
+  PhaseProfile *_profile;
+  Phase _phase;
+  double _bytes;
+  double _flops;
+  std::chrono::steady_clock::time_point _start;
+
+public:
+  ScopedPhase(PhaseProfile *profile, Phase phase, double bytes = 0, double flops = 0)
+      : _profile(profile), _phase(phase), _bytes(bytes), _flops(flops) {
+    if (_profile) {
+      _start = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~ScopedPhase() {
+    if (_profile) {
+      auto end = std::chrono::steady_clock::now();
+      _profile->add(_phase, std::chrono::duration<double>(end - _start).count(), _bytes, _flops);
+    }
+  }
+#else
+public:
+  ScopedPhase(PhaseProfile *, Phase, double = 0, double = 0) {}
+#endif
+
+  ScopedPhase(const ScopedPhase &) = delete;
+  ScopedPhase &operator=(const ScopedPhase &) = delete;
+};
@@ -1,4 +1,10 @@
 #include "bf.hpp"
+#include "hnsw.hpp"
+#include "ivf.hpp"
+#include "numa.hpp"
+#include "perf_counters.hpp"
+#include "streaming.hpp"
+#include "timing.hpp"
 #include "utils.h"
 #include "CLI11.hpp"
 
@@ -7,10 +13,14 @@ int main(int argc, char **argv) {
     argv = app.ensure_utf8(argv);
   
     std::string index_type = "flat";
-    app.add_option("--index-type", index_type, "Type of index to use (ivf, flat)");
+    app.add_option("--index-type", index_type, "Type of index to use (hnsw, ivf, flat)");
 
     std::string calc_recall = "false";
     app.add_option("--calc-recall", calc_recall, "Calculate recall (true / false)");
+
+    std::string gt_file;
+    app.add_option("--gt-file", gt_file,
+                   "Ground truth written by src/run_gen_gt for the same learn vectors, used for recall");
   
     std::string dataset_dir;
     app.add_option("-d,--dataset-dir", dataset_dir, "Path to the dataset");
@@ -18,6 +28,14 @@ int main(int argc, char **argv) {
     int64_t learn_limit = 10000;
     app.add_option("--learn-limit", learn_limit,
                    "Limit the number of learn vectors");
+
+    int64_t io_threads = 0;
+    app.add_option("--io-threads", io_threads,
+                   "Read the learn vectors with this many parallel O_DIRECT readers (0 maps the file)");
+
+    int64_t learn_offset = 0;
+    app.add_option("--learn-offset", learn_offset,
+                   "Index of the first learn vector to use");
   
     int64_t search_limit = 10000;
     app.add_option("--search-limit", search_limit,
@@ -29,6 +47,91 @@ int main(int argc, char **argv) {
     int64_t n_probe = 32;
     app.add_option("--n-probe", n_probe, "Number of probes");
 
+    int64_t ef = 256;
+    app.add_option("--ef", ef, "Number of neighbors to explore");
+
+    int64_t query_group = 1;
+    app.add_option("--hnsw-query-group", query_group,
+                   "Queries an hnsw search thread runs in lockstep, scored with one tile product (1 to 16)");
+
+    int64_t tile_rows = 4096;
+    app.add_option("--tile-rows", tile_rows,
+                   "Number of dataset vectors scored per GEMM tile");
+
+    int64_t query_block = 128;
+    app.add_option("--query-block", query_block,
+                   "Number of queries scored per GEMM tile");
+
+    std::string dis_metric = "ip";
+    app.add_option("--metric", dis_metric, "Distance metric to use (ip, l2, cosine)");
+
+    std::string precision = "bf16";
+    app.add_option("--precision", precision, "Dataset precision (bf16, int8)");
+
+    std::string int8_scale = "vector";
+    app.add_option("--int8-scale", int8_scale,
+                   "int8 quantization scale granularity (vector, dim)");
+
+    int64_t rerank = 0;
+    app.add_option("--rerank", rerank,
+                   "Rescore the best k * rerank int8 candidates in f32 (0 disables)");
+
+    std::string packed_file;
+    app.add_option("--packed-file", packed_file,
+                   "Map a dataset written by run_pack instead of reading dataset.bin");
+
+    std::string isa_cap = "auto";
+    app.add_option("--isa", isa_cap,
+                   "Highest instruction set to use (auto, amx_bf16, avx512_bf16, avx512f, avx2, scalar)");
+
+    std::string kernel_name = "onednn";
+    app.add_option("--kernel", kernel_name,
+                   "GEMM kernel for bf16 scoring (onednn, amx, emulated)");
+
+    int64_t small_batch = SMALL_BATCH_THRESHOLD;
+    app.add_option("--small-batch-threshold", small_batch,
+                   "Score at most this many queries with the AVX-512 GEMV path instead of the GEMM (0 disables)");
+
+    std::string parallelism_name = "auto";
+    app.add_option("--parallelism", parallelism_name,
+                   "Split of the top-k selection over threads (auto, query, shard, grid)");
+
+    std::string numa = "false";
+    app.add_option("--numa", numa,
+                   "Shard the flat dataset over the NUMA nodes (true / false)");
+
+    int64_t stream_rows = 0;
+    app.add_option("--stream-chunk-rows", stream_rows,
+                   "Stream the flat dataset from disk in chunks of this many vectors (0 loads it whole)");
+
+    int64_t batch_size = 0;
+    app.add_option("--batch-size", batch_size,
+                   "Queries per search call, 1 for one at a time (0 searches all at once)");
+
+    int32_t warmup = 1;
+    app.add_option("--warmup", warmup, "Searches over all queries left out of the statistics");
+
+    int32_t iterations = 10;
+    app.add_option("--iterations", iterations, "Searches over all queries that are measured");
+
+    std::string perf_counters = "false";
+    app.add_option("--perf-counters", perf_counters,
+                   "Count cycles, instructions, LLC and dTLB misses of the load, search and recall (true / false)");
+
+    std::string centroids_file;
+    app.add_option("--centroids-file", centroids_file,
+                   "IVF centroids written by run_kmeans, instead of training");
+
+    int64_t kmeans_samples = 0;
+    app.add_option("--kmeans-samples", kmeans_samples,
+                   "Train IVF k-means on this many sampled vectors (0 uses all of them)");
+
+    int64_t kmeans_iterations = 25;
+    app.add_option("--kmeans-iterations", kmeans_iterations, "Number of IVF k-means iterations");
+
+    int64_t kmeans_seed = 1234;
+    app.add_option("--kmeans-seed", kmeans_seed, "Seed of the IVF k-means sample");
+
     CLI11_PARSE(app, argc, argv);
   
     if (dataset_dir.empty()) {
@@ -36,24 +139,399 @@ int main(int argc, char **argv) {
       return 1;
     }
 
+    if (calc_recall == "true" && gt_file.empty()) {
+      std::cerr << "[ERROR] Recall needs a --gt-file from src/run_gen_gt" << std::endl;
+      return 1;
+    }
+
+    Metric metric;
+    if (!parse_metric(dis_metric, &metric)) {
+      std::cerr << "[ERROR] Invalid metric" << std::endl;
+      return 1;
+    }
+
+    if (precision != "bf16" && precision != "int8") {
+      std::cerr << "[ERROR] Invalid precision" << std::endl;
+      return 1;
+    }
+
+    Int8Scale int8_scale_mode;
+    if (!parse_int8_scale(int8_scale, &int8_scale_mode)) {
+      std::cerr << "[ERROR] Invalid int8 scale" << std::endl;
+      return 1;
+    }
+
+    Kernel kernel;
+    if (!parse_kernel(kernel_name, &kernel)) {
+      std::cerr << "[ERROR] Invalid kernel" << std::endl;
+      return 1;
+    }
+
+    Parallelism parallelism;
+    if (!parse_parallelism(parallelism_name, &parallelism)) {
+      std::cerr << "[ERROR] Invalid parallelism" << std::endl;
+      return 1;
+    }
+
+    if (kernel != Kernel::ONEDNN && (!packed_file.empty() || precision == "int8")) {
+      std::cerr << "[ERROR] Packed datasets and int8 require the onednn kernel" << std::endl;
+      return 1;
+    }
+
+    if (!packed_file.empty() && precision == "int8") {
+      std::cerr << "[ERROR] Packed datasets cannot be used with int8" << std::endl;
+      return 1;
+    }
+
+    Isa isa = detect_isa();
+    if (isa_cap != "auto") {
+      Isa cap;
+      if (!parse_isa(isa_cap, &cap)) {
+        std::cerr << "[ERROR] Invalid isa" << std::endl;
+        return 1;
+      }
+      isa = std::min(isa, cap);
+      limit_onednn_isa(isa);
+    }
+
     std::string dataset_path_learn = dataset_dir + "/dataset.bin";
     int64_t n_learn, dim_learn;
-    auto data_learn = read_bin_dataset(dataset_path_learn.c_str(), &n_learn, &dim_learn, learn_limit);
+    std::unique_ptr<DatasetView> learn_view;
+    const float *data_learn = nullptr;
+    if (stream_rows > 0) {
+      DatasetReader reader(dataset_path_learn, learn_offset, learn_limit);
+      n_learn = reader.n();
+      dim_learn = reader.dim();
+    } else if (packed_file.empty()) {
+      learn_view = std::make_unique<DatasetView>(dataset_path_learn, learn_offset, learn_limit,
+                                                 MAP_ADVICE_DEFAULT, io_threads);
+      n_learn = learn_view->n();
+      dim_learn = learn_view->dim();
+      data_learn = learn_view->data();
+    } else {
+      PackedHeader h = read_packed_header(MappedFile(packed_file));
+      n_learn = h.n;
+      dim_learn = h.dim;
+    }
     
     std::string dataset_path_query = dataset_dir + "/query.bin";
-    int64_t n_query, dim_query;
-    auto data_query = read_bin_dataset(dataset_path_query.c_str(), &n_query, &dim_query, search_limit);
-
-    auto bf_search = std::make_shared<BruteForceSearch>(dim_learn, n_query, n_learn);
-
-    for (int i = 0; i < 10; i++) {
-        auto s = std::chrono::high_resolution_clock::now();
-        auto results = bf_search->search_ip_amx(data_query, data_learn, top_k);
-        auto e = std::chrono::high_resolution_clock::now();
-        std::cout
-            << "[TIME] Search: [ index: amx_" << index_type << "_" << n_learn << "l.faiss ][ # queries: " << n_query << " ]: "
-            << std::chrono::duration_cast<std::chrono::microseconds>(e - s).count()
-            << " us" << std::endl;
+    DatasetView query_view(dataset_path_query, 0, search_limit);
+    int64_t n_query = query_view.n();
+
+    // Every index is built for a fixed number of queries per search, so
+    // the queries are split into batches of batch_nq up front, the last one
+    // padded with zero queries whose results are dropped
+    int64_t batch_nq = batch_size > 0 ? std::min(batch_size, n_query) : n_query;
+    std::vector<std::vector<float>> query_batches;
+    for (int64_t q0 = 0; q0 < n_query; q0 += batch_nq) {
+      int64_t rows = std::min(batch_nq, n_query - q0);
+      std::vector<float> batch(batch_nq * query_view.dim(), 0.0f);
+      std::copy(query_view.data() + q0 * query_view.dim(),
+                query_view.data() + (q0 + rows) * query_view.dim(), batch.begin());
+      query_batches.push_back(std::move(batch));
+    }
+
+    // Map the ground truth before searching, so a bad file fails early
+    std::unique_ptr<GroundTruthView> gt;
+    if (calc_recall == "true") {
+      gt = std::make_unique<GroundTruthView>(gt_file);
+    }
+
+    // Hardware counters, opened before any index is built so that they
+    // cover the OpenMP threads of every phase. Threads started later are
+    // not seen, so phases running on them are skipped with perf_unseen
+    // naming those threads
+    std::unique_ptr<PerfCounters> perf;
+    if (perf_counters == "true") {
+      perf = std::make_unique<PerfCounters>();
+      if (!perf->available()) {
+        std::cout << "[INFO] Perf: counters unavailable (" << perf->error() << ")" << std::endl;
+        perf.reset();
+      }
+    }
+
+    std::string perf_unseen;
+
+    // Runs fn and, with counters, prints its counts per query or vector
+    auto counted = [&](std::string index_name, std::string phase, int64_t n,
+                       std::string unit, auto fn) {
+      bool count = perf && perf_unseen.empty();
+      if (perf && !count) {
+        std::cout << "[INFO] Perf: [ index: " << index_name << " ][ phase: " << phase
+                  << " ]: skipped, runs on " << perf_unseen << std::endl;
+      }
+      if (count) {
+        perf->start();
+      }
+      fn();
+      if (count) {
+        print_perf(index_name, phase, perf->stop(), n, unit);
+      }
+    };
+
+    // Times the searches batch by batch and reports the latency
+    // percentiles, the mean QPS and, for flat indexes, the GFLOP/s of a full
+    // scan at that rate. IVF and HNSW score only a fraction of the dataset
+    // per query, so the same figure would overstate them
+    auto time_searches = [&](auto &index, std::string index_name,
+                             std::vector<float> &dis, std::vector<int64_t> &nns) {
+      std::vector<float> tail_dis(batch_nq * top_k);
+      std::vector<int64_t> tail_nns(batch_nq * top_k);
+      LatencyReport report;
+      // Counted over the warmup passes too
+      int64_t searched = (int64_t)(warmup + std::max(iterations, 1)) * n_query;
+      counted(index_name, "search", searched, "query", [&] {
+        report = measure_latency(
+          n_query, batch_nq, warmup, iterations, [&](int64_t q0, int64_t rows) {
+            std::vector<float> &batch = query_batches[q0 / batch_nq];
+            if (rows == batch_nq) {
+              index.search(batch, top_k, dis.data() + q0 * top_k, nns.data() + q0 * top_k);
+            } else {
+              index.search(batch, top_k, tail_dis.data(), tail_nns.data());
+              std::copy(tail_dis.begin(), tail_dis.begin() + rows * top_k, dis.begin() + q0 * top_k);
+              std::copy(tail_nns.begin(), tail_nns.begin() + rows * top_k, nns.begin() + q0 * top_k);
+            }
+          });
+      });
+      print_latency(index_name, report);
+      if (index_type == "flat") {
+        std::cout << "[INFO] GFLOP/s: [ index: " << index_name << " ]: "
+                  << 2.0 * n_query * n_learn * dim_learn / report.mean_us() / 1e3 << std::endl;
+      }
+    };
+
+    // Fraction of the reference top-k found in nns, over all queries
+    auto recall_against = [&](std::vector<int64_t> &nns, std::vector<int64_t> &ref_nns) {
+      return recall_at_k(nns.data(), ref_nns.data(), n_query, top_k, top_k);
+    };
+
+    // Recall against the ground truth file, with --calc-recall true
+    auto report_recall = [&](std::vector<int64_t> &nns, std::string index_name) {
+      if (gt) {
+        float recall;
+        counted(index_name, "recall", n_query, "query", [&] {
+          recall = recall_at_k(nns.data(), *gt, n_query, top_k);
+        });
+        std::cout << "[INFO] Recall@" << top_k << ": [ index: " << index_name << " ]: "
+                  << recall << std::endl;
+      }
+    };
+
+    // Times add() (or load() of the packed file) and 10 searches
+    auto run_search = [&](BruteForceSearch &bf_search, std::string index_name,
+                          std::vector<float> &dis, std::vector<int64_t> &nns,
+                          bool from_packed) {
+      bf_search.set_isa(isa);
+      bf_search.set_small_batch_threshold(small_batch);
+      bf_search.set_parallelism(parallelism);
+      auto s = std::chrono::high_resolution_clock::now();
+      counted(index_name, "load", n_learn, "vector", [&] {
+        if (from_packed) {
+          bf_search.load(packed_file);
+        } else {
+          bf_search.add(data_learn);
+        }
+      });
+      auto e = std::chrono::high_resolution_clock::now();
+      std::cout
+          << "[TIME] " << (from_packed ? "Load" : "Add") << ": [ index: " << index_name << " ]: "
+          << std::chrono::duration_cast<std::chrono::milliseconds>(e - s).count()
+          << " ms" << std::endl;
+      std::cout << "[INFO] ISA: [ index: " << index_name << " ]: "
+                << bf_search.describe_dispatch() << std::endl;
+      time_searches(bf_search, index_name, dis, nns);
+      // Phases of the add() or load() and of the last search
+      bf_search.phase_profile().print(index_name);
+    };
+
+    if (index_type == "ivf") {
+      if (!packed_file.empty() || precision == "int8" || kernel != Kernel::ONEDNN) {
+        std::cerr << "[ERROR] ivf supports bf16 with the default kernel only" << std::endl;
+        return 1;
+      }
+      // Same list count as the faiss IVFFlat builds in run_cpu
+      int64_t n_list = int64_t(4 * std::sqrt(n_learn));
+      std::vector<float> centroids;
+      if (!centroids_file.empty()) {
+        int64_t dim_centroids;
+        centroids = read_bin_dataset(centroids_file, &n_list, &dim_centroids, INT64_MAX);
+        if (dim_centroids != dim_learn) {
+          std::cerr << "[ERROR] Centroids do not match the dataset dimension" << std::endl;
+          return 1;
+        }
+        if (n_list < 1 || n_list > n_learn) {
+          std::cerr << "[ERROR] Centroids file has " << n_list
+                    << " lists, need between 1 and the number of dataset vectors" << std::endl;
+          return 1;
+        }
+      }
+      std::string index_name = "amx_ivf_" + std::to_string(n_learn) + "l_" +
+                               std::to_string(n_probe) + "p.faiss";
+      IVFSearch ivf_search(dim_learn, batch_nq, n_learn, n_list, query_block, metric);
+      ivf_search.set_isa(isa);
+      ivf_search.set_nprobe(n_probe);
+      std::cout << "[INFO] ISA: [ index: " << index_name << " ]: "
+                << ivf_search.describe_dispatch() << std::endl;
+
+      auto s = std::chrono::high_resolution_clock::now();
+      if (centroids.empty()) {
+        KMeansParams params;
+        params.max_samples = kmeans_samples;
+        params.iterations = kmeans_iterations;
+        params.seed = kmeans_seed;
+        ivf_search.train(data_learn, params);
+      } else {
+        ivf_search.set_centroids(std::move(centroids));
+      }
+      auto e = std::chrono::high_resolution_clock::now();
+      std::cout
+          << "[TIME] Train: [ index: " << index_name << " ][ # lists: " << n_list << " ]: "
+          << std::chrono::duration_cast<std::chrono::milliseconds>(e - s).count()
+          << " ms" << std::endl;
+      s = std::chrono::high_resolution_clock::now();
+      counted(index_name, "load", n_learn, "vector", [&] { ivf_search.add(data_learn); });
+      e = std::chrono::high_resolution_clock::now();
+      std::cout
+          << "[TIME] Add: [ index: " << index_name << " ]: "
+          << std::chrono::duration_cast<std::chrono::milliseconds>(e - s).count()
+          << " ms" << std::endl;
+
+      std::vector<int64_t> nns(top_k * n_query);
+      std::vector<float> dis(top_k * n_query);
+      time_searches(ivf_search, index_name, dis, nns);
+      report_recall(nns, index_name);
+      return 0;
+    }
+
+    if (index_type == "hnsw") {
+      if (!packed_file.empty() || precision == "int8" || kernel != Kernel::ONEDNN) {
+        std::cerr << "[ERROR] hnsw supports bf16 with the default kernel only" << std::endl;
+        return 1;
+      }
+      // Same M as the faiss IndexHNSWFlat builds in run_cpu
+      std::string index_name = "amx_hnsw_" + std::to_string(n_learn) + "l_" +
+                               std::to_string(ef) + "ef.faiss";
+      HNSWSearch hnsw_search(dim_learn, batch_nq, n_learn, 32, 40, metric);
+      hnsw_search.set_isa(isa);
+      hnsw_search.set_ef(ef);
+      hnsw_search.set_query_group(query_group);
+      std::cout << "[INFO] ISA: [ index: " << index_name << " ]: "
+                << hnsw_search.describe_dispatch() << std::endl;
+
+      auto s = std::chrono::high_resolution_clock::now();
+      counted(index_name, "load", n_learn, "vector", [&] { hnsw_search.add(data_learn); });
+      auto e = std::chrono::high_resolution_clock::now();
+      std::cout
+          << "[TIME] Add: [ index: " << index_name << " ]: "
+          << std::chrono::duration_cast<std::chrono::milliseconds>(e - s).count()
+          << " ms" << std::endl;
+
+      std::vector<int64_t> nns(top_k * n_query);
+      std::vector<float> dis(top_k * n_query);
+      time_searches(hnsw_search, index_name, dis, nns);
+      report_recall(nns, index_name);
+      return 0;
+    }
+
+    if (index_type != "flat") {
+      std::cerr << "[ERROR] Invalid index type" << std::endl;
+      return 1;
+    }
+
+    if (stream_rows > 0) {
+      if (!packed_file.empty() || precision == "int8" || kernel != Kernel::ONEDNN || numa == "true") {
+        std::cerr << "[ERROR] Streaming supports bf16 with the default kernel only" << std::endl;
+        return 1;
+      }
+      std::string index_name = "amx_flat_stream_" + std::to_string(n_learn) + "l.faiss";
+      StreamingSearch stream_search(dataset_path_learn, batch_nq, learn_offset, n_learn, stream_rows,
+                                    tile_rows, query_block, metric);
+      stream_search.set_isa(isa);
+      stream_search.set_small_batch_threshold(small_batch);
+      stream_search.set_parallelism(parallelism);
+      std::vector<int64_t> nns(top_k * n_query);
+      std::vector<float> dis(top_k * n_query);
+      // The chunks are read on a thread each search starts
+      perf_unseen = "the chunk reader thread";
+      time_searches(stream_search, index_name, dis, nns);
+      perf_unseen.clear();
+      report_recall(nns, index_name);
+      std::cout << "[INFO] ISA: [ index: " << index_name << " ]: "
+                << stream_search.describe_dispatch() << std::endl;
+      // Of the last search: reads run behind scoring, so only the time the
+      // scoring thread spent waiting for a chunk is exposed I/O
+      auto &stats = stream_search.stats();
+      std::cout << "[INFO] Stream: [ index: " << index_name << " ][ chunks: " << stats.chunks
+                << " ]: read " << stats.bytes / stats.read_seconds / 1e9 << " GB/s, "
+                << stats.read_seconds * 1e3 << " ms read, " << stats.wait_seconds * 1e3
+                << " ms waited, " << stats.score_seconds * 1e3 << " ms scored" << std::endl;
+      return 0;
+    }
+
+    if (numa == "true") {
+      if (!packed_file.empty() || precision == "int8" || kernel != Kernel::ONEDNN) {
+        std::cerr << "[ERROR] numa supports bf16 with the default kernel only" << std::endl;
+        return 1;
+      }
+      std::string index_name = "amx_flat_numa_" + std::to_string(n_learn) + "l.faiss";
+      NumaSearch numa_search(dim_learn, batch_nq, n_learn, tile_rows, query_block, metric);
+      numa_search.set_isa(isa);
+      numa_search.set_small_batch_threshold(small_batch);
+      numa_search.set_parallelism(parallelism);
+      // Shards are packed and searched on threads pinned to their node
+      perf_unseen = "the pinned node threads";
+      auto s = std::chrono::high_resolution_clock::now();
+      counted(index_name, "load", n_learn, "vector", [&] { numa_search.add(data_learn); });
+      auto e = std::chrono::high_resolution_clock::now();
+      std::cout
+          << "[TIME] Add: [ index: " << index_name << " ]: "
+          << std::chrono::duration_cast<std::chrono::milliseconds>(e - s).count()
+          << " ms" << std::endl;
+      std::cout << "[INFO] ISA: [ index: " << index_name << " ]: "
+                << numa_search.describe_dispatch() << std::endl;
+      std::vector<int64_t> nns(top_k * n_query);
+      std::vector<float> dis(top_k * n_query);
+      time_searches(numa_search, index_name, dis, nns);
+      perf_unseen.clear();
+      report_recall(nns, index_name);
+      // Of the last search, so every node runs with the others loading memory
+      for (auto &node : numa_search.node_stats()) {
+        std::cout << "[INFO] NUMA node " << node.node << ": [ index: " << index_name
+                  << " ][ threads: " << node.threads << " ][ rows: " << node.rows << " ]: "
+                  << node.seconds * 1e6 << " us, " << node.bytes / node.seconds / 1e9 << " GB/s, "
+                  << n_query / node.seconds << " QPS" << std::endl;
+      }
+      return 0;
+    }
+
+    std::string index_name = "amx_" + index_type + "_" + std::to_string(n_learn) + "l.faiss";
+    BruteForceSearch bf16_search(dim_learn, batch_nq, n_learn, tile_rows, query_block, metric);
+    if (kernel != Kernel::ONEDNN) {
+      if (kernel == Kernel::AMX_TILE && std::min(detect_isa(), isa) < Isa::AMX_BF16) {
+        std::cerr << "[ERROR] The amx kernel needs AMX-BF16" << std::endl;
+        return 1;
+      }
+      bf16_search.set_isa(isa);
+      bf16_search.set_kernel(kernel);
+      index_name = "amx_" + index_type + "_" + kernel_name + "_" + std::to_string(n_learn) + "l.faiss";
+    }
+    std::vector<int64_t> nns(top_k * n_query);
+    std::vector<float> dis(top_k * n_query);
+    run_search(bf16_search, index_name, dis, nns, !packed_file.empty());
+    report_recall(nns, index_name);
+
+    if (precision == "int8") {
+      BruteForceSearch int8_search(dim_learn, batch_nq, n_learn, tile_rows, query_block, metric);
+      int8_search.set_int8(int8_scale_mode, rerank);
+      std::vector<int64_t> int8_nns(top_k * n_query);
+      std::vector<float> int8_dis(top_k * n_query);
+      std::string int8_name = "amx_" + index_type + "_int8_" + int8_scale +
+                              "_r" + std::to_string(rerank) + "_" + std::to_string(n_learn) + "l.faiss";
+      run_search(int8_search, int8_name, int8_dis, int8_nns, false);
+      report_recall(int8_nns, int8_name);
+
+      std::cout << "[INFO] Recall@" << top_k << " of int8 against bf16: "
+                << recall_against(int8_nns, nns) << std::endl;
     }
 
     return 0;
@@ -3,13 +3,18 @@ set -e
 
 export LD_LIBRARY_PATH=/usr/local/lib:$LD_LIBRARY_PATH
 
+# Parallel O_DIRECT readers for the learn set; 0 maps it instead
+IO_THREADS=${IO_THREADS:-16}
+
 run_flat() {
     ./run_amx \
         --index-type flat \
         --dataset-dir /workspace/dataset/t2i \
+        --io-threads ${IO_THREADS} \
         --learn-limit ${1} \
         --search-limit ${2} \
         --top-k 10 \
+        --gt-file /workspace/dataset/t2i/gt_${1}l_10000q_10k.bin \
         --calc-recall true
 }
 
@@ -27,3 +32,173 @@ run_flat 10000000 10
 run_flat 10000000 100
 run_flat 10000000 1000
 run_flat 10000000 10000
+
+# Same learn sizes, batch sizes and nprobe as the faiss IVFFlat runs in
+# src/run_cpu_index.sh
+run_ivf() {
+    ./run_amx \
+        --index-type ivf \
+        --dataset-dir /workspace/dataset/t2i \
+        --io-threads ${IO_THREADS} \
+        --learn-limit ${1} \
+        --search-limit ${2} \
+        --top-k 10 \
+        --n-probe ${3} \
+        --metric ip \
+        --gt-file /workspace/dataset/t2i/gt_${1}l_10000q_10k.bin \
+        --calc-recall true
+}
+
+run_ivf  100000 10    32
+run_ivf  100000 100   32
+run_ivf  100000 1000  32
+run_ivf  100000 10000 32
+
+run_ivf  1000000 10    48
+run_ivf  1000000 100   48
+run_ivf  1000000 1000  48
+run_ivf  1000000 10000 48
+
+run_ivf  10000000 10    64
+run_ivf  10000000 100   64
+run_ivf  10000000 1000  64
+run_ivf  10000000 10000 64
+
+# Same learn sizes, batch sizes and ef as the faiss HNSW runs in
+# src/run_cpu_index.sh
+run_hnsw() {
+    ./run_amx \
+        --index-type hnsw \
+        --dataset-dir /workspace/dataset/t2i \
+        --io-threads ${IO_THREADS} \
+        --learn-limit ${1} \
+        --search-limit ${2} \
+        --top-k 10 \
+        --ef ${3} \
+        --metric ip \
+        --gt-file /workspace/dataset/t2i/gt_${1}l_10000q_10k.bin \
+        --calc-recall true
+}
+
+run_hnsw 100000 10    32
+run_hnsw 100000 100   32
+run_hnsw 100000 1000  32
+run_hnsw 100000 10000 32
+
+run_hnsw 1000000 10    96
+run_hnsw 1000000 100   96
+run_hnsw 1000000 1000  96
+run_hnsw 1000000 10000 96
+
+run_hnsw 10000000 10    512
+run_hnsw 10000000 100   512
+run_hnsw 10000000 1000  512
+run_hnsw 10000000 10000 512
+
+# oneDNN against the native AMX tile kernel, nq = 1 to 10K
+run_kernel() {
+    ./run_amx \
+        --index-type flat \
+        --dataset-dir /workspace/dataset/t2i \
+        --io-threads ${IO_THREADS} \
+        --learn-limit ${1} \
+        --search-limit ${2} \
+        --top-k 10 \
+        --kernel ${3}
+}
+
+for nq in 1 10 100 1000 10000; do
+    run_kernel 1000000 ${nq} onednn
+    run_kernel 1000000 ${nq} amx
+done
+
+# Small-batch GEMV path against the GEMM, to place --small-batch-threshold
+run_small_batch() {
+    ./run_amx \
+        --index-type flat \
+        --dataset-dir /workspace/dataset/t2i \
+        --io-threads ${IO_THREADS} \
+        --learn-limit ${1} \
+        --search-limit ${2} \
+        --top-k 10 \
+        --small-batch-threshold ${3}
+}
+
+for nq in 1 2 4 8 16 32 64; do
+    run_small_batch 1000000 ${nq} 0
+    run_small_batch 1000000 ${nq} 64
+done
+
+# Top-k selection split by query only against the adaptive choice of
+# query, shard or grid parallelism, with the GEMV path off
+run_parallelism() {
+    ./run_amx \
+        --index-type flat \
+        --dataset-dir /workspace/dataset/t2i \
+        --io-threads ${IO_THREADS} \
+        --learn-limit ${1} \
+        --search-limit ${2} \
+        --top-k 10 \
+        --small-batch-threshold 0 \
+        --parallelism ${3}
+}
+
+for nl in 1000000 10000000; do
+    for nq in 1 10 100 1000 10000; do
+        run_parallelism ${nl} ${nq} query
+        run_parallelism ${nl} ${nq} auto
+    done
+done
+
+# One dataset shard per NUMA node against a single shared dataset
+run_numa() {
+    ./run_amx \
+        --index-type flat \
+        --dataset-dir /workspace/dataset/t2i \
+        --io-threads ${IO_THREADS} \
+        --learn-limit ${1} \
+        --search-limit ${2} \
+        --top-k 10 \
+        --numa ${3}
+}
+
+for nq in 10 1000 10000; do
+    run_numa 10000000 ${nq} false
+    run_numa 10000000 ${nq} true
+done
+
+# The full 50M learn set streamed from disk, 1M vectors per chunk
+run_stream() {
+    ./run_amx \
+        --index-type flat \
+        --dataset-dir /workspace/dataset/t2i \
+        --io-threads ${IO_THREADS} \
+        --learn-limit ${1} \
+        --search-limit ${2} \
+        --top-k 10 \
+        --stream-chunk-rows ${3}
+}
+
+run_stream 50000000 1000  1048576
+run_stream 50000000 10000 1048576
+
+# Per-query latency of 10K queries issued one at a time and in batches
+run_latency() {
+    ./run_amx \
+        --index-type ${1} \
+        --dataset-dir /workspace/dataset/t2i \
+        --io-threads ${IO_THREADS} \
+        --learn-limit ${2} \
+        --search-limit 10000 \
+        --top-k 10 \
+        --ef 96 \
+        --n-probe 48 \
+        --metric ip \
+        --batch-size ${3}
+}
+
+for batch in 1 8 64 512; do
+    run_latency flat 1000000 ${batch}
+    run_latency ivf  1000000 ${batch}
+    run_latency hnsw 1000000 ${batch}
+done
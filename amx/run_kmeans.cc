@@ -0,0 +1,80 @@
+#include "kmeans.hpp"
+#include "utils.h"
+#include "CLI11.hpp"
+
+int main(int argc, char **argv) {
+    CLI::App app{"Train IVF centroids with AMX k-means"};
+    argv = app.ensure_utf8(argv);
+
+    std::string dataset_dir;
+    app.add_option("-d,--dataset-dir", dataset_dir, "Path to the dataset");
+
+    std::string centroids_file;
+    app.add_option("-o,--centroids-file", centroids_file,
+                   "Output centroids, in the dataset.bin format");
+
+    int64_t learn_limit = 10000;
+    app.add_option("--learn-limit", learn_limit,
+                   "Limit the number of learn vectors");
+
+    int64_t io_threads = 0;
+    app.add_option("--io-threads", io_threads,
+                   "Read the learn vectors with this many parallel O_DIRECT readers (0 maps the file)");
+
+    int64_t n_list = 0;
+    app.add_option("--n-list", n_list,
+                   "Number of centroids (default 4 * sqrt(learn vectors), as run_cpu)");
+
+    int64_t samples = 0;
+    app.add_option("--samples", samples,
+                   "Train on this many sampled vectors (0 uses all of them)");
+
+    int64_t iterations = 25;
+    app.add_option("--iterations", iterations, "Number of k-means iterations");
+
+    int64_t seed = 1234;
+    app.add_option("--seed", seed, "Seed of the sample and the initial centroids");
+
+    std::string dis_metric = "ip";
+    app.add_option("--metric", dis_metric,
+                   "Distance metric of the index (ip, l2, cosine); cosine trains spherical k-means");
+
+    CLI11_PARSE(app, argc, argv);
+
+    if (dataset_dir.empty() || centroids_file.empty()) {
+      std::cerr << "[ERROR] Please provide a dataset and a centroids file" << std::endl;
+      return 1;
+    }
+
+    Metric metric;
+    if (!parse_metric(dis_metric, &metric)) {
+      std::cerr << "[ERROR] Invalid metric" << std::endl;
+      return 1;
+    }
+
+    std::string dataset_path_learn = dataset_dir + "/dataset.bin";
+    DatasetView data_learn(dataset_path_learn, 0, learn_limit, MAP_ADVICE_DEFAULT, io_threads);
+    int64_t n_learn = data_learn.n(), dim_learn = data_learn.dim();
+    if (n_list <= 0) {
+      n_list = int64_t(4 * std::sqrt(n_learn));
+    }
+
+    KMeansParams params;
+    params.max_samples = samples;
+    params.iterations = iterations;
+    params.seed = seed;
+    params.spherical = metric == Metric::COSINE;
+    params.verbose = true;
+
+    auto s = std::chrono::high_resolution_clock::now();
+    auto centroids = kmeans_train(data_learn.data(), n_learn, dim_learn, n_list, params);
+    auto e = std::chrono::high_resolution_clock::now();
+    std::cout
+        << "[TIME] Train: [ # lists: " << n_list << " ][ # samples: "
+        << (samples > 0 ? std::min(samples, n_learn) : n_learn) << " ]: "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(e - s).count()
+        << " ms" << std::endl;
+
+    write_bin_dataset(centroids_file, centroids.data(), n_list, dim_learn);
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "bf.hpp"
+#include "utils.h"
+#include "CLI11.hpp"
+
+int main(int argc, char **argv) {
+    CLI::App app{"Convert a dataset to the packed bf16 format read by run_amx"};
+    argv = app.ensure_utf8(argv);
+
+    std::string dataset_dir;
+    app.add_option("-d,--dataset-dir", dataset_dir, "Path to the dataset");
+
+    std::string packed_file;
+    app.add_option("-o,--packed-file", packed_file, "Path of the packed dataset to write");
+
+    int64_t learn_limit = 10000;
+    app.add_option("--learn-limit", learn_limit,
+                   "Limit the number of learn vectors");
+
+    int64_t tile_rows = 4096;
+    app.add_option("--tile-rows", tile_rows,
+                   "Number of dataset vectors scored per GEMM tile");
+
+    int64_t query_block = 128;
+    app.add_option("--query-block", query_block,
+                   "Number of queries scored per GEMM tile");
+
+    std::string dis_metric = "ip";
+    app.add_option("--metric", dis_metric, "Distance metric to use (ip, l2, cosine)");
+
+    CLI11_PARSE(app, argc, argv);
+
+    if (dataset_dir.empty() || packed_file.empty()) {
+      std::cerr << "[ERROR] Please provide a dataset and a packed file" << std::endl;
+      return 1;
+    }
+
+    Metric metric;
+    if (!parse_metric(dis_metric, &metric)) {
+      std::cerr << "[ERROR] Invalid metric" << std::endl;
+      return 1;
+    }
+
+    std::string dataset_path_learn = dataset_dir + "/dataset.bin";
+    DatasetView data_learn(dataset_path_learn, 0, learn_limit);
+    int64_t n_learn = data_learn.n(), dim_learn = data_learn.dim();
+
+    BruteForceSearch bf_search(dim_learn, query_block, n_learn, tile_rows, query_block, metric);
+    // The file holds GEMM tiles, whatever the query block size
+    bf_search.set_small_batch_threshold(0);
+    auto s = std::chrono::high_resolution_clock::now();
+    bf_search.add(data_learn.data());
+    bf_search.save(packed_file);
+    auto e = std::chrono::high_resolution_clock::now();
+    std::cout
+        << "[TIME] Pack: [ file: " << packed_file << " ]: "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(e - s).count()
+        << " ms" << std::endl;
+
+    return 0;
+}
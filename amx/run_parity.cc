@@ -0,0 +1,106 @@
+#include <cmath>
+#include <unordered_set>
+
+#include <faiss/IndexFlat.h>
+
+#include "bf.hpp"
+#include "utils.h"
+#include "CLI11.hpp"
+
+int main(int argc, char **argv) {
+    CLI::App app{"Check BruteForceSearch against faiss::IndexFlat"};
+    argv = app.ensure_utf8(argv);
+
+    std::string dataset_dir;
+    app.add_option("-d,--dataset-dir", dataset_dir, "Path to the dataset");
+
+    int64_t learn_limit = 10000;
+    app.add_option("--learn-limit", learn_limit,
+                   "Limit the number of learn vectors");
+
+    int64_t search_limit = 10000;
+    app.add_option("--search-limit", search_limit,
+                   "Limit the number of search vectors");
+
+    int64_t top_k = 10;
+    app.add_option("-k,--top-k", top_k, "Number of nearest neighbors");
+
+    std::string dis_metric = "ip";
+    app.add_option("--metric", dis_metric, "Distance metric to use (ip, l2, cosine)");
+
+    CLI11_PARSE(app, argc, argv);
+
+    if (dataset_dir.empty()) {
+      std::cerr << "[ERROR] Please provide a dataset" << std::endl;
+      return 1;
+    }
+
+    Metric metric;
+    if (!parse_metric(dis_metric, &metric)) {
+      std::cerr << "[ERROR] Invalid metric" << std::endl;
+      return 1;
+    }
+
+    std::string dataset_path_learn = dataset_dir + "/dataset.bin";
+    int64_t n_learn, dim_learn;
+    auto data_learn = read_bin_dataset(dataset_path_learn.c_str(), &n_learn, &dim_learn, learn_limit);
+
+    std::string dataset_path_query = dataset_dir + "/query.bin";
+    int64_t n_query, dim_query;
+    auto data_query = read_bin_dataset(dataset_path_query.c_str(), &n_query, &dim_query, search_limit);
+
+    std::vector<int64_t> amx_nns(top_k * n_query);
+    std::vector<float> amx_dis(top_k * n_query);
+    auto bf_search = std::make_shared<BruteForceSearch>(
+      dim_learn, n_query, n_learn, 4096, 128, metric);
+    bf_search->add(data_learn);
+    auto s = std::chrono::high_resolution_clock::now();
+    bf_search->search(data_query, top_k, amx_dis.data(), amx_nns.data());
+    auto e = std::chrono::high_resolution_clock::now();
+    std::cout
+        << "[TIME] Search: [ index: amx_flat_" << n_learn << "l ][ # queries: " << n_query << " ]: "
+        << std::chrono::duration_cast<std::chrono::microseconds>(e - s).count()
+        << " us" << std::endl;
+
+    std::vector<faiss::idx_t> faiss_nns(top_k * n_query);
+    std::vector<float> faiss_dis(top_k * n_query);
+    // faiss has no cosine metric, so it gets normalized copies with IP
+    auto faiss_metric_type = (metric == Metric::L2) ? faiss::METRIC_L2 : faiss::METRIC_INNER_PRODUCT;
+    if (metric == Metric::COSINE) {
+      for (int64_t i = 0; i < n_learn; i++) {
+        normalize(data_learn.data() + i * dim_learn, dim_learn);
+      }
+      for (int64_t i = 0; i < n_query; i++) {
+        normalize(data_query.data() + i * dim_query, dim_query);
+      }
+    }
+    faiss::IndexFlat faiss_index(dim_learn, faiss_metric_type);
+    faiss_index.add(n_learn, data_learn.data());
+    s = std::chrono::high_resolution_clock::now();
+    faiss_index.search(n_query, data_query.data(), top_k, faiss_dis.data(), faiss_nns.data());
+    e = std::chrono::high_resolution_clock::now();
+    std::cout
+        << "[TIME] Search: [ index: faiss_flat_" << n_learn << "l ][ # queries: " << n_query << " ]: "
+        << std::chrono::duration_cast<std::chrono::microseconds>(e - s).count()
+        << " us" << std::endl;
+
+    // bf16 rounding can reorder near-ties, so compare the id sets per query
+    // and bound the score error relative to the faiss f32 scores
+    int64_t matches = 0;
+    double max_rel_err = 0;
+    for (int64_t i = 0; i < n_query; i++) {
+      std::unordered_set<int64_t> gt(faiss_nns.begin() + i * top_k,
+                                     faiss_nns.begin() + (i + 1) * top_k);
+      for (int64_t n = 0; n < top_k; n++) {
+        matches += gt.count(amx_nns[i * top_k + n]);
+        double ref = faiss_dis[i * top_k + n];
+        double err = std::fabs(amx_dis[i * top_k + n] - ref) / std::max(std::fabs(ref), 1e-6);
+        max_rel_err = std::max(max_rel_err, err);
+      }
+    }
+    std::cout << "[INFO] Overlap@" << top_k << " with faiss: "
+              << 1.0f * matches / (top_k * n_query) << std::endl;
+    std::cout << "[INFO] Max relative score error at rank: " << max_rel_err << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "bf.hpp"
+#include "topk.hpp"
+
+/**
+ * @brief Random access to rows [offset, offset + limit) of a dataset.bin
+ * file (uint32 n, uint32 dim, then n x dim f32) without reading it whole.
+ * Reads use pread(), so several threads may read different rows at once.
+ */
+class DatasetReader {
+  int _fd = -1;
+  int64_t _offset = 0;
+  int64_t _n = 0;
+  int64_t _dim = 0;
+
+public:
+  DatasetReader(const std::string &path, int64_t offset = 0, int64_t limit = INT64_MAX) {
+    _fd = open(path.c_str(), O_RDONLY);
+    if (_fd < 0) {
+      throw std::runtime_error("Could not open " + path);
+    }
+    uint32_t header[2];
+    if (pread(_fd, header, sizeof(header), 0) != sizeof(header)) {
+      close(_fd);
+      throw std::runtime_error("Could not read the header of " + path);
+    }
+    _offset = std::min(std::max(offset, (int64_t)0), (int64_t)header[0]);
+    _n = std::min((int64_t)header[0] - _offset, limit);
+    _dim = header[1];
+  }
+
+  ~DatasetReader() {
+    close(_fd);
+  }
+
+  DatasetReader(const DatasetReader &) = delete;
+  DatasetReader &operator=(const DatasetReader &) = delete;
+
+  int64_t n() const { return _n; }
+  int64_t dim() const { return _dim; }
+
+  // Read rows [start, start + count) of the range into dst
+  void read_rows(int64_t start, int64_t count, float *dst) const {
+    char *p = reinterpret_cast<char *>(dst);
+    int64_t offset = 2 * sizeof(uint32_t) + (_offset + start) * _dim * sizeof(float);
+    int64_t left = count * _dim * sizeof(float);
+    while (left > 0) {
+      ssize_t got = pread(_fd, p, left, offset);
+      if (got <= 0) {
+        throw std::runtime_error("Short read of dataset rows");
+      }
+      p += got;
+      offset += got;
+      left -= got;
+    }
+  }
+};
+
+/**
+ * @brief Exact search over a dataset that is streamed from disk in chunks
+ * instead of being held in memory.
+ *
+ * Every search reads the file again, chunk_rows vectors at a time, into one
+ * of two buffers: while chunk i is packed and scored by a BruteForceSearch
+ * over that chunk alone, chunk i + 1 is read into the other buffer by a
+ * background thread. The per-chunk top-k results are folded into a running
+ * nq x k heap arena with the chunk's base added to the ids, so memory is
+ * bounded by two f32 chunks plus one packed chunk whatever the file size.
+ */
+class StreamingSearch {
+  DatasetReader _reader;
+  int32_t _nq;
+  int32_t _chunk_rows;
+  int32_t _tile_rows;
+  int32_t _query_block;
+  Metric _metric;
+  Isa _isa;
+  int32_t _small_batch_threshold = SMALL_BATCH_THRESHOLD;
+  Parallelism _parallelism = Parallelism::AUTO;
+
+  // Searches over full chunks are reused; the shorter last chunk gets its own
+  std::unique_ptr<BruteForceSearch> _full;
+  std::unique_ptr<BruteForceSearch> _tail;
+
+public:
+  // I/O and compute split of the last search()
+  struct StreamStats {
+    int64_t chunks;
+    double bytes;
+    double read_seconds;
+    double wait_seconds;
+    double score_seconds;
+  };
+
+private:
+  StreamStats _stats{};
+
+public:
+  StreamingSearch(const std::string &path, int32_t nq, int64_t offset, int64_t limit,
+                  int32_t chunk_rows = 1 << 20, int32_t tile_rows = 4096,
+                  int32_t query_block = 128, Metric metric = Metric::INNER_PRODUCT)
+      : _reader(path, offset, limit), _nq(nq), _tile_rows(tile_rows),
+        _query_block(query_block), _metric(metric), _isa(detect_isa()) {
+    if (chunk_rows <= 0) {
+      throw std::runtime_error("Stream chunks need at least one row");
+    }
+    if (_reader.n() <= 0) {
+      throw std::runtime_error("No rows to stream from " + path + " at offset " +
+                               std::to_string(offset));
+    }
+    _chunk_rows = std::min<int64_t>(chunk_rows, _reader.n());
+  }
+
+  // Same as BruteForceSearch::set_isa()
+  void set_isa(Isa isa) {
+    _isa = std::min(_isa, isa);
+  }
+
+  void set_small_batch_threshold(int32_t nq) {
+    _small_batch_threshold = nq;
+  }
+
+  void set_parallelism(Parallelism parallelism) {
+    _parallelism = parallelism;
+  }
+
+  int64_t n() const { return _reader.n(); }
+  int64_t dim() const { return _reader.dim(); }
+
+  const StreamStats &stats() const { return _stats; }
+
+  // Human readable summary of the chunking and of the chunk kernels, once
+  // a search has run
+  std::string describe_dispatch() const {
+    std::string chunks = "streamed in " + std::to_string(_chunk_rows) + " row chunks";
+    return _full ? chunks + " " + _full->describe_dispatch() : chunks;
+  }
+
+  /**
+   * @brief Stream the whole dataset once and find the top_k nearest
+   * vectors of every query.
+   *
+   * @param queries Row-major (nq x dim) f32 queries
+   * @param top_k Number of neighbors per query
+   * @param distances Output (nq x top_k) scores, best first per query
+   * @param labels Output (nq x top_k) dataset ids
+   */
+  void search(std::vector<float> &queries, int32_t top_k,
+              float *distances, int64_t *labels) {
+    if (keep_largest(_metric)) {
+      search_impl<true>(queries, top_k, distances, labels);
+    } else {
+      search_impl<false>(queries, top_k, distances, labels);
+    }
+  }
+
+private:
+  BruteForceSearch &chunk_search(int32_t rows) {
+    auto &search = rows == _chunk_rows ? _full : _tail;
+    if (!search) {
+      search = std::make_unique<BruteForceSearch>(
+        _reader.dim(), _nq, rows, _tile_rows, _query_block, _metric);
+      search->set_isa(_isa);
+      search->set_small_batch_threshold(_small_batch_threshold);
+      search->set_parallelism(_parallelism);
+    }
+    return *search;
+  }
+
+  template <bool KeepLargest>
+  void search_impl(std::vector<float> &queries, int32_t top_k,
+                   float *out_dis, int64_t *out_ids) {
+    int64_t n = _reader.n();
+    int64_t dim = _reader.dim();
+    int64_t n_chunks = (n + _chunk_rows - 1) / _chunk_rows;
+    _stats = StreamStats{n_chunks, (double)n * dim * sizeof(float), 0, 0, 0};
+
+    for (int32_t i = 0; i < _nq; i++) {
+      heap_init<KeepLargest>(out_dis + (int64_t)i * top_k, out_ids + (int64_t)i * top_k, top_k);
+    }
+    std::vector<float> part_dis((int64_t)_nq * top_k);
+    std::vector<int64_t> part_ids((int64_t)_nq * top_k);
+
+    std::vector<float> buffers[2];
+    buffers[0].resize((int64_t)_chunk_rows * dim);
+    buffers[1].resize((int64_t)_chunk_rows * dim);
+    auto read_chunk = [&](int64_t c) {
+      auto s = std::chrono::high_resolution_clock::now();
+      int64_t start = c * _chunk_rows;
+      _reader.read_rows(start, std::min<int64_t>(_chunk_rows, n - start), buffers[c % 2].data());
+      auto e = std::chrono::high_resolution_clock::now();
+      return std::chrono::duration<double>(e - s).count();
+    };
+
+    std::future<double> next = std::async(std::launch::async, read_chunk, 0);
+    for (int64_t c = 0; c < n_chunks; c++) {
+      auto s = std::chrono::high_resolution_clock::now();
+      _stats.read_seconds += next.get();
+      auto w = std::chrono::high_resolution_clock::now();
+      _stats.wait_seconds += std::chrono::duration<double>(w - s).count();
+      if (c + 1 < n_chunks) {
+        next = std::async(std::launch::async, read_chunk, c + 1);
+      }
+
+      int64_t base = c * _chunk_rows;
+      int32_t rows = std::min<int64_t>(_chunk_rows, n - base);
+      std::vector<float> &chunk = buffers[c % 2];
+      if (rows < _chunk_rows) {
+        chunk.resize((int64_t)rows * dim);
+      }
+      BruteForceSearch &search = chunk_search(rows);
+      search.add(chunk);
+      search.search(queries, top_k, part_dis.data(), part_ids.data());
+
+      #pragma omp parallel for
+      for (int32_t i = 0; i < _nq; i++) {
+        float *d = out_dis + (int64_t)i * top_k;
+        int64_t *l = out_ids + (int64_t)i * top_k;
+        for (int32_t j = 0; j < top_k; j++) {
+          int64_t p = (int64_t)i * top_k + j;
+          if (part_ids[p] >= 0 && heap_better<KeepLargest>(part_dis[p], d[0])) {
+            heap_replace_top<KeepLargest>(d, l, top_k, part_dis[p], base + part_ids[p]);
+          }
+        }
+      }
+      auto e = std::chrono::high_resolution_clock::now();
+      _stats.score_seconds += std::chrono::duration<double>(e - w).count();
+    }
+
+    #pragma omp parallel for
+    for (int32_t i = 0; i < _nq; i++) {
+      heap_sort<KeepLargest>(out_dis + (int64_t)i * top_k, out_ids + (int64_t)i * top_k, top_k);
+    }
+  }
+};
@@ -0,0 +1,303 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+#include <vector>
+
+/**
+ * Native AMX-BF16 inner-product kernel over a pre-packed dataset, plus a
+ * portable emulation of the same blocked computation.
+ *
+ * Layout, with the dimension zero-padded to kp, a multiple of 32:
+ *
+ *   queries: row-major bf16, (nq_pad x kp), nq_pad a multiple of 16.
+ *   dataset: blocks of 16 vectors. Each block holds kp / 32 B tiles of
+ *            16 rows x 32 bf16, where row r of tile c holds dimensions
+ *            (32c + 2r, 32c + 2r + 1) of all 16 vectors interleaved
+ *            (the VNNI pair layout TDPBF16PS expects).
+ *
+ * A query tile of 16 x 32 bf16 times one B tile accumulates a 16 x 16 f32
+ * score tile. The kernel keeps 2 x 2 score tiles in registers (tmm0-3), with
+ * two query tiles (tmm4-5) and two dataset blocks (tmm6-7) per step.
+ */
+
+static constexpr int32_t TILE_ROWS = 16;
+static constexpr int32_t TILE_K = 32;
+
+inline int32_t tile_padded_dim(int32_t dim) {
+  return (dim + TILE_K - 1) / TILE_K * TILE_K;
+}
+
+inline int32_t tile_padded_rows(int32_t n) {
+  return (n + TILE_ROWS - 1) / TILE_ROWS * TILE_ROWS;
+}
+
+// Round-to-nearest-even f32 -> bf16, as the oneDNN reorder does
+inline uint16_t f32_to_bf16(float f) {
+  uint32_t u;
+  std::memcpy(&u, &f, sizeof(u));
+  if ((u & 0x7fffffff) > 0x7f800000) {
+    return (uint16_t)((u >> 16) | 0x40);
+  }
+  u += 0x7fff + ((u >> 16) & 1);
+  return (uint16_t)(u >> 16);
+}
+
+inline float bf16_to_f32(uint16_t h) {
+  uint32_t u = (uint32_t)h << 16;
+  float f;
+  std::memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+/**
+ * @brief Pack n row-major f32 queries into zero-padded bf16 rows.
+ *
+ * @param out Buffer of tile_padded_rows(n) * tile_padded_dim(dim) values
+ */
+inline void tile_pack_queries(const float *q, int32_t n, int32_t dim, uint16_t *out) {
+  int32_t kp = tile_padded_dim(dim);
+  int32_t n_pad = tile_padded_rows(n);
+  std::memset(out, 0, (size_t)n_pad * kp * sizeof(uint16_t));
+  for (int32_t i = 0; i < n; i++) {
+    for (int32_t c = 0; c < dim; c++) {
+      out[(int64_t)i * kp + c] = f32_to_bf16(q[(int64_t)i * dim + c]);
+    }
+  }
+}
+
+/**
+ * @brief Pack n row-major f32 dataset vectors into blocks of 16 in the
+ * VNNI pair layout.
+ *
+ * @param out Buffer of tile_padded_rows(n) * tile_padded_dim(dim) values
+ */
+inline void tile_pack_dataset(const float *x, int32_t n, int32_t dim, uint16_t *out) {
+  int32_t kp = tile_padded_dim(dim);
+  int32_t n_pad = tile_padded_rows(n);
+  std::memset(out, 0, (size_t)n_pad * kp * sizeof(uint16_t));
+  for (int32_t j = 0; j < n; j++) {
+    uint16_t *block = out + (int64_t)(j / TILE_ROWS) * TILE_ROWS * kp;
+    int32_t col = j % TILE_ROWS;
+    for (int32_t c = 0; c < dim; c++) {
+      int32_t chunk = c / TILE_K;
+      int32_t r = (c % TILE_K) / 2;
+      int32_t p = c % 2;
+      block[chunk * TILE_ROWS * TILE_K + r * TILE_K + col * 2 + p] =
+        f32_to_bf16(x[(int64_t)j * dim + c]);
+    }
+  }
+}
+
+/**
+ * @brief Write one bf16 row of kp values as column col of a single packed
+ * block (16 x kp), e.g. to score gathered rows against one vector.
+ */
+inline void tile_pack_column(const uint16_t *row, int32_t kp, int32_t col, uint16_t *block) {
+  // Pair p of the row lands in 32-bit slot col of the p-th 64 bytes
+  for (int32_t p = 0; p < kp / 2; p++) {
+    std::memcpy(block + ((int64_t)p * TILE_ROWS + col) * 2, row + 2 * p, sizeof(uint32_t));
+  }
+}
+
+struct TileConfig {
+  uint8_t palette_id;
+  uint8_t start_row;
+  uint8_t reserved[14];
+  uint16_t colsb[16];
+  uint8_t rows[16];
+};
+
+__attribute__((target("amx-tile")))
+inline void tile_configure() {
+  TileConfig cfg = {};
+  cfg.palette_id = 1;
+  for (int t = 0; t < 8; t++) {
+    cfg.rows[t] = TILE_ROWS;
+    cfg.colsb[t] = 64;
+  }
+  // GCC does not see that LDTILECFG reads cfg and drops the stores above
+  asm volatile("" : : "r"(&cfg) : "memory");
+  _tile_loadconfig(&cfg);
+}
+
+// Give the tile state back to the OS once a thread is done with AMX
+__attribute__((target("amx-tile")))
+inline void tile_release() {
+  _tile_release();
+}
+
+// One (QT x 16) x (XT x 16) score block, QT and XT in {1, 2}
+template <int QT, int XT>
+__attribute__((target("amx-tile,amx-bf16")))
+inline void tile_block_amx(const uint16_t *q, const uint16_t *x, int32_t kp,
+                           float *scores, int64_t ld) {
+  const int64_t q_stride = (int64_t)kp * sizeof(uint16_t);
+  const int64_t x_block = (int64_t)TILE_ROWS * kp;
+  _tile_zero(0);
+  if (XT == 2) _tile_zero(1);
+  if (QT == 2) _tile_zero(2);
+  if (QT == 2 && XT == 2) _tile_zero(3);
+  for (int32_t c = 0; c < kp; c += TILE_K) {
+    const uint16_t *b = x + (int64_t)c * TILE_ROWS;
+    _tile_loadd(4, q + c, q_stride);
+    _tile_loadd(6, b, 64);
+    _tile_dpbf16ps(0, 4, 6);
+    if (XT == 2) {
+      _tile_loadd(7, b + x_block, 64);
+      _tile_dpbf16ps(1, 4, 7);
+    }
+    if (QT == 2) {
+      _tile_loadd(5, q + (int64_t)TILE_ROWS * kp + c, q_stride);
+      _tile_dpbf16ps(2, 5, 6);
+      if (XT == 2) {
+        _tile_dpbf16ps(3, 5, 7);
+      }
+    }
+  }
+  const int64_t s_stride = ld * sizeof(float);
+  _tile_stored(0, scores, s_stride);
+  if (XT == 2) _tile_stored(1, scores + TILE_ROWS, s_stride);
+  if (QT == 2) _tile_stored(2, scores + TILE_ROWS * ld, s_stride);
+  if (QT == 2 && XT == 2) _tile_stored(3, scores + TILE_ROWS * ld + TILE_ROWS, s_stride);
+}
+
+// Score the (up to) 32 x 32 block of queries from q0 and vectors from x0
+__attribute__((target("amx-tile,amx-bf16")))
+inline void tile_score_amx_pair(const uint16_t *q, int32_t nq_pad, const uint16_t *x,
+                                int32_t nl_pad, int32_t kp, float *scores, int64_t ld,
+                                const float *bias, int32_t q0, int32_t x0) {
+  bool q2 = q0 + TILE_ROWS < nq_pad;
+  bool x2 = x0 + TILE_ROWS < nl_pad;
+  const uint16_t *qp = q + (int64_t)q0 * kp;
+  const uint16_t *xp = x + (int64_t)x0 * kp;
+  float *sp = scores + q0 * ld + x0;
+  if (q2 && x2) {
+    tile_block_amx<2, 2>(qp, xp, kp, sp, ld);
+  } else if (q2) {
+    tile_block_amx<2, 1>(qp, xp, kp, sp, ld);
+  } else if (x2) {
+    tile_block_amx<1, 2>(qp, xp, kp, sp, ld);
+  } else {
+    tile_block_amx<1, 1>(qp, xp, kp, sp, ld);
+  }
+  if (bias) {
+    for (int32_t i = q0; i < q0 + (q2 ? 2 : 1) * TILE_ROWS; i++) {
+      for (int32_t j = x0; j < x0 + (x2 ? 2 : 1) * TILE_ROWS; j++) {
+        scores[i * ld + j] += bias[j];
+      }
+    }
+  }
+}
+
+/**
+ * @brief Score packed queries against packed dataset vectors with AMX.
+ *
+ * @param q Queries from tile_pack_queries(), nq_pad rows
+ * @param x Dataset from tile_pack_dataset(), nl_pad vectors
+ * @param scores Output (nq_pad x nl_pad) scores with row stride ld
+ * @param bias Optional per dataset vector term added to every score
+ */
+__attribute__((target("amx-tile,amx-bf16")))
+inline void tile_score_amx(const uint16_t *q, int32_t nq_pad, const uint16_t *x,
+                           int32_t nl_pad, int32_t kp, float *scores, int64_t ld,
+                           const float *bias = nullptr) {
+  int32_t q_pairs = (nq_pad + 2 * TILE_ROWS - 1) / (2 * TILE_ROWS);
+  int32_t x_pairs = (nl_pad + 2 * TILE_ROWS - 1) / (2 * TILE_ROWS);
+  #pragma omp parallel
+  {
+    tile_configure();
+    #pragma omp for collapse(2) schedule(static)
+    for (int32_t qi = 0; qi < q_pairs; qi++) {
+      for (int32_t xi = 0; xi < x_pairs; xi++) {
+        tile_score_amx_pair(q, nq_pad, x, nl_pad, kp, scores, ld, bias,
+                            qi * 2 * TILE_ROWS, xi * 2 * TILE_ROWS);
+      }
+    }
+    _tile_release();
+  }
+}
+
+/**
+ * @brief Single-threaded tile_score_amx() for small products issued from
+ * inside a parallel region. The calling thread must have run
+ * tile_configure() first.
+ */
+__attribute__((target("amx-tile,amx-bf16")))
+inline void tile_score_amx_serial(const uint16_t *q, int32_t nq_pad, const uint16_t *x,
+                                  int32_t nl_pad, int32_t kp, float *scores, int64_t ld,
+                                  const float *bias = nullptr) {
+  for (int32_t q0 = 0; q0 < nq_pad; q0 += 2 * TILE_ROWS) {
+    for (int32_t x0 = 0; x0 < nl_pad; x0 += 2 * TILE_ROWS) {
+      tile_score_amx_pair(q, nq_pad, x, nl_pad, kp, scores, ld, bias, q0, x0);
+    }
+  }
+}
+
+// TDPBF16PS treats denormal inputs and results as zero
+inline float flush_denormal(float f) {
+  uint32_t u;
+  std::memcpy(&u, &f, sizeof(u));
+  if ((u & 0x7f800000) == 0) {
+    u &= 0x80000000;
+    std::memcpy(&f, &u, sizeof(f));
+  }
+  return f;
+}
+
+// Add an exact bf16 x bf16 product to an f32 sum with a single rounding.
+// The product fits in 16 bits, so the f64 sum only rounds when the two are
+// too far apart for the f32 result to see the difference.
+inline float tile_add_product(float sum, float a, float b) {
+  return flush_denormal((float)((double)sum + (double)a * b));
+}
+
+/**
+ * @brief Portable emulation of tile_score_amx: the same packed inputs, and
+ * per score the accumulation order of TDPBF16PS on Sapphire Rapids, which
+ * is bit-exact with the hardware. Each instruction covers one 32-dimension
+ * chunk and keeps two f32 sums, one over the even and one over the odd
+ * elements of its 16 pairs, each adding exact products in order with one
+ * rounding per step. The two sums are then added together and the result
+ * added to the score, every step rounding to nearest even with denormals
+ * flushed. This is not the pair-by-pair order of the SDM pseudocode.
+ */
+inline void tile_score_emulated_row(const uint16_t *qr, const uint16_t *x, int32_t nl_pad,
+                                    int32_t kp, float *row, const float *bias) {
+  for (int32_t j = 0; j < nl_pad; j++) {
+    const uint16_t *block = x + (int64_t)(j / TILE_ROWS) * TILE_ROWS * kp;
+    int32_t col = j % TILE_ROWS;
+    float acc = 0.0f;
+    for (int32_t c0 = 0; c0 < kp; c0 += TILE_K) {
+      const uint16_t *b = block + (c0 / TILE_K) * TILE_ROWS * TILE_K + col * 2;
+      float even = 0.0f, odd = 0.0f;
+      for (int32_t r = 0; r < TILE_K / 2; r++) {
+        even = tile_add_product(even, flush_denormal(bf16_to_f32(qr[c0 + 2 * r])),
+                                flush_denormal(bf16_to_f32(b[r * TILE_K])));
+        odd = tile_add_product(odd, flush_denormal(bf16_to_f32(qr[c0 + 2 * r + 1])),
+                               flush_denormal(bf16_to_f32(b[r * TILE_K + 1])));
+      }
+      acc = flush_denormal(acc + flush_denormal(even + odd));
+    }
+    row[j] = bias ? acc + bias[j] : acc;
+  }
+}
+
+inline void tile_score_emulated(const uint16_t *q, int32_t nq_pad, const uint16_t *x,
+                                int32_t nl_pad, int32_t kp, float *scores, int64_t ld,
+                                const float *bias = nullptr) {
+  #pragma omp parallel for schedule(static)
+  for (int32_t i = 0; i < nq_pad; i++) {
+    tile_score_emulated_row(q + (int64_t)i * kp, x, nl_pad, kp, scores + i * ld, bias);
+  }
+}
+
+// Single-threaded tile_score_emulated(), the counterpart of tile_score_amx_serial()
+inline void tile_score_emulated_serial(const uint16_t *q, int32_t nq_pad, const uint16_t *x,
+                                       int32_t nl_pad, int32_t kp, float *scores, int64_t ld,
+                                       const float *bias = nullptr) {
+  for (int32_t i = 0; i < nq_pad; i++) {
+    tile_score_emulated_row(q + (int64_t)i * kp, x, nl_pad, kp, scores + i * ld, bias);
+  }
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Latency histogram in the style of HdrHistogram. Values below
+ * 2 * SUB_BUCKETS nanoseconds get a bucket each; above that every power of
+ * two is split into SUB_BUCKETS linear buckets, so a percentile is off by
+ * less than 1 / SUB_BUCKETS of its value. Recording is a shift and an
+ * increment, and the counts take a fixed 60 KB whatever the sample count.
+ */
+class LatencyHistogram {
+  static constexpr int SUB_BITS = 7;
+  static constexpr int64_t SUB_BUCKETS = 1 << SUB_BITS;
+
+  std::vector<int64_t> _counts = std::vector<int64_t>((64 - SUB_BITS + 1) * SUB_BUCKETS, 0);
+  int64_t _total = 0;
+  int64_t _max = 0;
+  double _sum = 0;
+
+  static int64_t bucket_of(int64_t ns) {
+    if (ns < 2 * SUB_BUCKETS) {
+      return ns;
+    }
+    int shift = 63 - __builtin_clzll(ns) - SUB_BITS;
+    return (shift + 1) * SUB_BUCKETS + (ns >> shift) - SUB_BUCKETS;
+  }
+
+  // Largest value that falls in bucket b
+  static int64_t bucket_max(int64_t b) {
+    if (b < 2 * SUB_BUCKETS) {
+      return b;
+    }
+    int shift = b / SUB_BUCKETS - 1;
+    return ((b % SUB_BUCKETS + SUB_BUCKETS + 1) << shift) - 1;
+  }
+
+public:
+  // Record count samples of ns nanoseconds each
+  void record(int64_t ns, int64_t count = 1) {
+    ns = std::max<int64_t>(ns, 0);
+    _counts[bucket_of(ns)] += count;
+    _total += count;
+    _max = std::max(_max, ns);
+    _sum += (double)ns * count;
+  }
+
+  int64_t count() const { return _total; }
+  int64_t max_ns() const { return _max; }
+  double mean_ns() const { return _total ? _sum / _total : 0.0; }
+
+  // Smallest recorded value that p percent of the samples do not exceed
+  int64_t percentile_ns(double p) const {
+    int64_t rank = std::max<int64_t>(1, (int64_t)(p / 100.0 * _total + 0.5));
+    int64_t seen = 0;
+    for (size_t b = 0; b < _counts.size(); b++) {
+      seen += _counts[b];
+      if (seen >= rank) {
+        return std::min(bucket_max(b), _max);
+      }
+    }
+    return _max;
+  }
+};
+
+/**
+ * @brief Latencies of a measure_latency() run. Every query is charged the
+ * time of the batch it was searched in, which is what its caller waits.
+ */
+struct LatencyReport {
+  int64_t batch_size;
+  int32_t warmup;
+  // Wall time of each measured pass over the queries
+  std::vector<int64_t> iteration_us;
+  LatencyHistogram latency;
+  int64_t queries = 0;
+  double seconds = 0;
+
+  double qps() const { return queries / seconds; }
+  int64_t best_us() const { return *std::min_element(iteration_us.begin(), iteration_us.end()); }
+  double mean_us() const { return seconds * 1e6 / iteration_us.size(); }
+};
+
+/**
+ * @brief Search all n_query queries warmup + iterations times, batch_size
+ * queries per call (all of them when batch_size <= 0), and collect the
+ * latencies of the last iterations (at least one) only.
+ *
+ * @param search Called as search(q0, rows) to search queries [q0, q0 + rows)
+ */
+template <typename SearchFn>
+LatencyReport measure_latency(int64_t n_query, int64_t batch_size, int32_t warmup,
+                              int32_t iterations, SearchFn search) {
+  LatencyReport report;
+  report.batch_size = batch_size > 0 ? std::min(batch_size, n_query) : n_query;
+  report.warmup = warmup;
+  iterations = std::max(iterations, 1);
+  for (int32_t itr = 0; itr < warmup + iterations; itr++) {
+    bool measured = itr >= warmup;
+    auto start = std::chrono::steady_clock::now();
+    for (int64_t q0 = 0; q0 < n_query; q0 += report.batch_size) {
+      int64_t rows = std::min(report.batch_size, n_query - q0);
+      auto s = std::chrono::steady_clock::now();
+      search(q0, rows);
+      auto e = std::chrono::steady_clock::now();
+      if (measured) {
+        report.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(e - s).count(), rows);
+      }
+    }
+    auto end = std::chrono::steady_clock::now();
+    if (measured) {
+      report.iteration_us.push_back(
+        std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+      report.seconds += std::chrono::duration<double>(end - start).count();
+      report.queries += n_query;
+    }
+  }
+  return report;
+}
+
+// Print the per-iteration times, the latency percentiles and the mean QPS
+void print_latency(const std::string &index_name, const LatencyReport &report) {
+  for (int64_t us : report.iteration_us) {
+    std::cout
+        << "[TIME] Search: [ index: " << index_name << " ][ # queries: "
+        << report.queries / (int64_t)report.iteration_us.size() << " ]: " << us << " us" << std::endl;
+  }
+  const LatencyHistogram &h = report.latency;
+  std::cout
+      << "[INFO] Latency: [ index: " << index_name << " ][ batch: " << report.batch_size
+      << " ]: p50 " << h.percentile_ns(50) / 1e3 << " us, p90 " << h.percentile_ns(90) / 1e3
+      << " us, p99 " << h.percentile_ns(99) / 1e3 << " us, p99.9 " << h.percentile_ns(99.9) / 1e3
+      << " us, max " << h.max_ns() / 1e3 << " us" << std::endl;
+  std::cout
+      << "[INFO] QPS: [ index: " << index_name << " ][ batch: " << report.batch_size << " ]: "
+      << report.qps() << " (mean of " << report.iteration_us.size() << " iterations, "
+      << report.warmup << " warmup excluded)" << std::endl;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdint>
+#include <immintrin.h>
+#include <limits>
+
+#include "isa.hpp"
+
+/**
+ * Bounded top-k kept as a binary heap over a caller-owned slice of a flat
+ * (nq x k) ids/distances arena. The root is always the worst kept entry.
+ * With KeepLargest (inner product) the heap is a min-heap and keeps the
+ * largest scores; otherwise (L2) it is a max-heap and keeps the smallest.
+ * The heap always holds k entries: it is seeded with sentinels, so an
+ * insert is a single compare against the root followed by a sift-down,
+ * with no size bookkeeping or allocation.
+ */
+
+template <bool KeepLargest>
+inline bool heap_better(float a, float b) {
+  return KeepLargest ? a > b : a < b;
+}
+
+template <bool KeepLargest>
+inline void heap_init(float *dis, int64_t *ids, int32_t k) {
+  for (int32_t i = 0; i < k; i++) {
+    dis[i] = KeepLargest ? -std::numeric_limits<float>::infinity()
+                         : std::numeric_limits<float>::infinity();
+    ids[i] = -1;
+  }
+}
+
+// Replace the root with (d, id) and restore the heap property
+template <bool KeepLargest>
+inline void heap_replace_top(float *dis, int64_t *ids, int32_t k,
+                             float d, int64_t id) {
+  int32_t i = 0;
+  while (true) {
+    int32_t l = 2 * i + 1;
+    if (l >= k) {
+      break;
+    }
+    int32_t r = l + 1;
+    int32_t c = (r < k && heap_better<KeepLargest>(dis[l], dis[r])) ? r : l;
+    if (!heap_better<KeepLargest>(d, dis[c])) {
+      break;
+    }
+    dis[i] = dis[c];
+    ids[i] = ids[c];
+    i = c;
+  }
+  dis[i] = d;
+  ids[i] = id;
+}
+
+// Offer every score in a row, with ids starting at base
+template <bool KeepLargest>
+inline void heap_add_row(float *dis, int64_t *ids, int32_t k,
+                         const float *row, int32_t n, int64_t base) {
+  for (int32_t j = 0; j < n; j++) {
+    if (heap_better<KeepLargest>(row[j], dis[0])) {
+      heap_replace_top<KeepLargest>(dis, ids, k, row[j], base + j);
+    }
+  }
+}
+
+/**
+ * Same as heap_add_row, but compares 16 scores at a time against the
+ * current k-th best (the heap root), two vectors per step, and only touches
+ * the heap for lanes that beat it. Once the heap is warm almost every block
+ * is rejected by a single compare and mask test.
+ */
+template <bool KeepLargest>
+__attribute__((target("avx512f")))
+inline void heap_add_row_avx512(float *dis, int64_t *ids, int32_t k,
+                                const float *row, int32_t n, int64_t base) {
+  constexpr int pred = KeepLargest ? _CMP_GT_OQ : _CMP_LT_OQ;
+  int32_t j = 0;
+  __m512 thresh = _mm512_set1_ps(dis[0]);
+  for (; j + 32 <= n; j += 32) {
+    __mmask16 m0 = _mm512_cmp_ps_mask(_mm512_loadu_ps(row + j), thresh, pred);
+    __mmask16 m1 = _mm512_cmp_ps_mask(_mm512_loadu_ps(row + j + 16), thresh, pred);
+    uint32_t m = (uint32_t)m0 | ((uint32_t)m1 << 16);
+    if (m == 0) {
+      continue;
+    }
+    while (m) {
+      int32_t lane = __builtin_ctz(m);
+      m &= m - 1;
+      float d = row[j + lane];
+      if (heap_better<KeepLargest>(d, dis[0])) {
+        heap_replace_top<KeepLargest>(dis, ids, k, d, base + j + lane);
+      }
+    }
+    thresh = _mm512_set1_ps(dis[0]);
+  }
+  heap_add_row<KeepLargest>(dis, ids, k, row + j, n - j, base + j);
+}
+
+// AVX2 variant of heap_add_row_avx512, 8 scores per compare
+template <bool KeepLargest>
+__attribute__((target("avx2")))
+inline void heap_add_row_avx2(float *dis, int64_t *ids, int32_t k,
+                              const float *row, int32_t n, int64_t base) {
+  constexpr int pred = KeepLargest ? _CMP_GT_OQ : _CMP_LT_OQ;
+  int32_t j = 0;
+  __m256 thresh = _mm256_set1_ps(dis[0]);
+  for (; j + 16 <= n; j += 16) {
+    uint32_t m0 = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(row + j), thresh, pred));
+    uint32_t m1 = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(row + j + 8), thresh, pred));
+    uint32_t m = m0 | (m1 << 8);
+    if (m == 0) {
+      continue;
+    }
+    while (m) {
+      int32_t lane = __builtin_ctz(m);
+      m &= m - 1;
+      float d = row[j + lane];
+      if (heap_better<KeepLargest>(d, dis[0])) {
+        heap_replace_top<KeepLargest>(dis, ids, k, d, base + j + lane);
+      }
+    }
+    thresh = _mm256_set1_ps(dis[0]);
+  }
+  heap_add_row<KeepLargest>(dis, ids, k, row + j, n - j, base + j);
+}
+
+template <bool KeepLargest>
+using heap_add_row_fn = void (*)(float *, int64_t *, int32_t, const float *, int32_t, int64_t);
+
+// Fastest heap_add_row variant the instruction set can run
+template <bool KeepLargest>
+inline heap_add_row_fn<KeepLargest> select_heap_add_row(Isa isa) {
+  if (isa >= Isa::AVX512F) {
+    return heap_add_row_avx512<KeepLargest>;
+  }
+  if (isa >= Isa::AVX2) {
+    return heap_add_row_avx2<KeepLargest>;
+  }
+  return heap_add_row<KeepLargest>;
+}
+
+// Sort the heap in place, best entry first
+template <bool KeepLargest>
+inline void heap_sort(float *dis, int64_t *ids, int32_t k) {
+  for (int32_t n = k - 1; n > 0; n--) {
+    float d = dis[n];
+    int64_t id = ids[n];
+    dis[n] = dis[0];
+    ids[n] = ids[0];
+    heap_replace_top<KeepLargest>(dis, ids, n, d, id);
+  }
+}
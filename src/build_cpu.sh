@@ -1,4 +1,5 @@
 #!/bin/bash
 set -e
 
-g++ -std=c++17 -O3 run_cpu.cc -lfaiss_avx512 -o run_cpu
+g++ -std=c++17 -O3 run_cpu.cc -lfaiss_avx512 -fopenmp -o run_cpu
+g++ -std=c++17 -O3 run_gen_gt.cc -lfaiss_avx512 -fopenmp -o run_gen_gt
@@ -3,10 +3,14 @@ set -e
 
 export LD_LIBRARY_PATH=/usr/local/lib:$LD_LIBRARY_PATH
 
+# Parallel O_DIRECT readers for the learn set; 0 maps it instead
+IO_THREADS=${IO_THREADS:-16}
+
 build_flat() {
   ./run_cpu \
     --index-type flat \
     --dataset-dir /workspace/dataset/t2i \
+    --io-threads ${IO_THREADS} \
     --learn-limit ${1} \
     --metric ip \
     --index-file cpu_flat_${1}l.faiss
@@ -16,6 +20,7 @@ build_ivf() {
   ./run_cpu \
       --index-type ivf \
       --dataset-dir /workspace/dataset/t2i \
+      --io-threads ${IO_THREADS} \
       --learn-limit ${1} \
       --metric ip \
       --index-file cpu_ivf_${1}l.faiss
@@ -25,11 +30,29 @@ build_hnsw() {
   ./run_cpu \
       --index-type hnsw \
       --dataset-dir /workspace/dataset/t2i \
+      --io-threads ${IO_THREADS} \
       --learn-limit ${1} \
       --metric ip \
       --index-file cpu_hnsw_${1}l.faiss
 }
 
+# IVF built on centroids from the AMX k-means trainer instead of faiss train()
+build_ivf_amx_kmeans() {
+  ../amx/run_kmeans \
+      --dataset-dir /workspace/dataset/t2i \
+      --io-threads ${IO_THREADS} \
+      --learn-limit ${1} \
+      --metric ip \
+      --centroids-file centroids_${1}l.bin
+  ./run_cpu \
+      --index-type ivf \
+      --dataset-dir /workspace/dataset/t2i \
+      --io-threads ${IO_THREADS} \
+      --learn-limit ${1} \
+      --metric ip \
+      --centroids-file centroids_${1}l.bin \
+      --index-file cpu_ivf_amx_kmeans_${1}l.faiss
+}
 
 build_flat 100000
 build_flat 1000000
@@ -39,6 +62,10 @@ build_ivf  100000
 build_ivf  1000000
 build_ivf  10000000
 
+build_ivf_amx_kmeans 100000
+build_ivf_amx_kmeans 1000000
+build_ivf_amx_kmeans 10000000
+
 build_hnsw 100000
 build_hnsw 1000000
 build_hnsw 10000000
@@ -1,4 +1,4 @@
 #!/bin/bash
 set -e
 
-g++ -std=c++17 -O3 run_cpu.cc -lfaiss_avx512_spr -o run_cpu
+g++ -std=c++17 -O3 run_cpu.cc -lfaiss_avx512_spr -fopenmp -o run_cpu
@@ -3,10 +3,14 @@ set -e
 
 export LD_LIBRARY_PATH=/usr/local/lib:$LD_LIBRARY_PATH
 
+# Parallel O_DIRECT readers for the learn set; 0 maps it instead
+IO_THREADS=${IO_THREADS:-16}
+
 build_flat() {
     ./run_gpu \
         --index-type flat \
         --dataset-dir /workspace/dataset/t2i \
+        --io-threads ${IO_THREADS} \
         --learn-limit ${1} \
         --metric ip \
         --index-file gpu_flat_${1}l.faiss
@@ -16,6 +20,7 @@ build_ivf() {
     ./run_gpu \
         --index-type ivf \
         --dataset-dir /workspace/dataset/t2i \
+        --io-threads ${IO_THREADS} \
         --learn-limit ${1} \
         --metric ip \
         --index-file gpu_ivf_${1}l.faiss
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * @brief Hardware counts of one measured phase, summed over threads and
+ * scaled up when the kernel multiplexed the counters. A count the CPU or
+ * the kernel does not expose is -1.
+ */
+struct PerfSample {
+  double seconds = 0;
+  int64_t cycles = -1;
+  int64_t instructions = -1;
+  int64_t llc_misses = -1;
+  int64_t dtlb_misses = -1;
+};
+
+/**
+ * @brief Cycles, instructions, last-level cache misses and dTLB load misses
+ * of the whole process, through perf_event_open().
+ *
+ * Counters cannot follow the threads of a running pool, so one counter
+ * group is opened per thread that exists at construction; the OpenMP pool
+ * is started first so that its threads are included. Threads created later
+ * (e.g. the per-node threads of a NUMA search) are not counted. Only user
+ * space is counted, which perf_event_paranoid <= 2 allows unprivileged.
+ *
+ * Where perf_event_open() is not permitted, as in most containers,
+ * available() is false, error() says why, and the samples are empty.
+ */
+class PerfCounters {
+  enum Event { CYCLES, INSTRUCTIONS, LLC_MISSES, DTLB_MISSES, N_EVENTS };
+
+  struct Group {
+    int fds[N_EVENTS];
+  };
+  std::vector<Group> _groups;
+  std::string _error;
+  std::chrono::steady_clock::time_point _start;
+
+  static int open_event(Event event, pid_t tid, int group_fd) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    switch (event) {
+      case CYCLES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+      case INSTRUCTIONS:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+      case LLC_MISSES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+      default:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    }
+    attr.disabled = group_fd < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, tid, -1, group_fd, 0);
+  }
+
+  static std::vector<pid_t> process_threads() {
+    std::vector<pid_t> tids;
+    DIR *dir = opendir("/proc/self/task");
+    if (!dir) {
+      return tids;
+    }
+    while (dirent *entry = readdir(dir)) {
+      if (entry->d_name[0] != '.') {
+        tids.push_back(atoi(entry->d_name));
+      }
+    }
+    closedir(dir);
+    return tids;
+  }
+
+public:
+  PerfCounters() {
+    #pragma omp parallel
+    {
+    }
+    for (pid_t tid : process_threads()) {
+      Group g;
+      g.fds[CYCLES] = open_event(CYCLES, tid, -1);
+      if (g.fds[CYCLES] < 0) {
+        _error = std::string("perf_event_open: ") + strerror(errno);
+        continue;
+      }
+      // Events the CPU lacks are left out of the group
+      for (int e = INSTRUCTIONS; e < N_EVENTS; e++) {
+        g.fds[e] = open_event((Event)e, tid, g.fds[CYCLES]);
+      }
+      _groups.push_back(g);
+    }
+  }
+
+  ~PerfCounters() {
+    for (auto &g : _groups) {
+      for (int fd : g.fds) {
+        if (fd >= 0) {
+          close(fd);
+        }
+      }
+    }
+  }
+
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  bool available() const { return !_groups.empty(); }
+  const std::string &error() const { return _error; }
+
+  // Zero and start every group
+  void start() {
+    for (auto &g : _groups) {
+      ioctl(g.fds[CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(g.fds[CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    _start = std::chrono::steady_clock::now();
+  }
+
+  // Stop every group and sum the counts since start()
+  PerfSample stop() {
+    PerfSample sample;
+    sample.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+    for (auto &g : _groups) {
+      ioctl(g.fds[CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+    int64_t *counts[N_EVENTS] = {&sample.cycles, &sample.instructions, &sample.llc_misses,
+                                 &sample.dtlb_misses};
+    for (auto &g : _groups) {
+      for (int e = 0; e < N_EVENTS; e++) {
+        uint64_t value[3];
+        if (g.fds[e] < 0 || read(g.fds[e], value, sizeof(value)) != sizeof(value)) {
+          continue;
+        }
+        // value = {count, time enabled, time running}
+        double scale = value[2] > 0 ? (double)value[1] / value[2] : 0.0;
+        *counts[e] = std::max<int64_t>(*counts[e], 0) + (int64_t)(value[0] * scale);
+      }
+    }
+    return sample;
+  }
+};
+
+/**
+ * @brief Print IPC and the cycles and misses per item (query, or vector for
+ * an index load) of a phase. The LLC miss traffic assumes one 64-byte line
+ * per miss, a lower bound on memory bandwidth since prefetched lines do
+ * not miss.
+ */
+inline void print_perf(const std::string &index_name, const std::string &phase,
+                const PerfSample &s, int64_t n, const std::string &unit = "query") {
+  if (s.cycles < 0) {
+    return;
+  }
+  std::cout << "[INFO] Perf: [ index: " << index_name << " ][ phase: " << phase << " ]: ";
+  if (s.instructions >= 0 && s.cycles > 0) {
+    std::cout << "IPC " << (double)s.instructions / s.cycles << ", ";
+  }
+  std::cout << (double)s.cycles / n << " cycles/" << unit;
+  if (s.llc_misses >= 0) {
+    std::cout << ", " << (double)s.llc_misses / n << " LLC misses/" << unit << ", "
+              << s.llc_misses * 64.0 / s.seconds / 1e9 << " GB/s LLC miss traffic";
+  }
+  if (s.dtlb_misses >= 0) {
+    std::cout << ", " << (double)s.dtlb_misses / n << " dTLB misses/" << unit;
+  }
+  std::cout << std::endl;
+}
@@ -1,17 +1,20 @@
 #include <chrono>
 #include <cmath>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <vector>
 
 #include "CLI11.hpp"
 #include <faiss/IndexFlat.h>
 #include <faiss/IndexHNSW.h>
 #include <faiss/IndexIVFFlat.h>
-#include <faiss/gpu/GpuIndexFlat.h>
-#include <faiss/gpu/StandardGpuResources.h>
 #include <faiss/index_io.h>
 
 #include "utils.h"
+#include "perf_counters.h"
+#include "sweep.h"
+#include "timing.h"
 
 /**
  * @brief Create a HNSW index using the CPU
@@ -27,26 +30,6 @@ faiss::Index *CPU_create_hnsw_index(int64_t dim, std::string dis_metric) {
   return index;
 }
 
-/**
- * @brief Create a Flat index using the GPU
- *
- * @param dim The dimension of the vectors
- * @param mem_type The memory type to use
- * @param provider The GPU resources provider
- * @param cuda_device The CUDA device to use
- */
-faiss::Index *GPU_create_flat_index(int64_t dim, std::string mem_type,
-                                    faiss::gpu::GpuResourcesProvider *provider,
-                                    int64_t cuda_device) {
-  auto config = faiss::gpu::GpuIndexConfig();
-  config.device = cuda_device;
-  config.memorySpace = (mem_type == "cuda") ? faiss::gpu::MemorySpace::Device
-                                            : faiss::gpu::MemorySpace::Unified;
-  auto index = new faiss::gpu::GpuIndexFlatIP(
-      provider, dim, faiss::gpu::GpuIndexFlatConfig{config});
-  return index;
-}
-
 /**
   * @brief Create an IVF index using the CPU
   *
@@ -71,6 +54,92 @@ faiss::Index *CPU_create_flat_index(int64_t dim, std::string dis_metric) {
   return new faiss::IndexFlat(dim, faiss_metric_type);
 }
 
+/**
+ * @brief Run every sweep point in one process. Each index file is read
+ * once and searched for all of its points before the next one is read, and
+ * the queries are mapped once. With calc_recall, recall is measured against
+ * the point's own ground truth file or else gt_file, each mapped once.
+ * Every point is searched batch_size queries at a time.
+ */
+int run_sweep(std::vector<SweepPoint> points, std::string dataset_dir, bool calc_recall,
+              std::string gt_file, std::string results_file, int64_t batch_size,
+              int32_t warmup, int32_t iterations) {
+  int64_t max_nq = 0;
+  for (auto &p : points) {
+    max_nq = std::max(max_nq, p.nq);
+    if (!calc_recall) {
+      p.gt_file.clear();
+    } else if (p.gt_file.empty()) {
+      p.gt_file = gt_file;
+    }
+  }
+
+  std::string dataset_path_query = dataset_dir + "/query.bin";
+  DatasetView data_query(dataset_path_query, 0, max_nq);
+  std::map<std::string, std::unique_ptr<GroundTruthView>> gts;
+
+  SweepWriter writer(results_file);
+  std::vector<bool> done(points.size(), false);
+  for (size_t first = 0; first < points.size(); first++) {
+    if (done[first]) {
+      continue;
+    }
+    std::string index_file = points[first].index_file;
+    auto s = std::chrono::high_resolution_clock::now();
+    faiss::Index *ridx = faiss::read_index(index_file.c_str());
+    auto e = std::chrono::high_resolution_clock::now();
+    std::cout
+        << "[TIME] Load: [ index: " << index_file << " ]: "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(e - s).count()
+        << " ms" << std::endl;
+
+    for (size_t i = first; i < points.size(); i++) {
+      SweepPoint &p = points[i];
+      if (done[i] || p.index_file != index_file) {
+        continue;
+      }
+      done[i] = true;
+      // The type comes from the sweep file, so check it against the index
+      faiss::IndexIVFFlat *ivf = dynamic_cast<faiss::IndexIVFFlat*>(ridx);
+      faiss::IndexHNSWFlat *hnsw = dynamic_cast<faiss::IndexHNSWFlat*>(ridx);
+      if ((p.index_type == "ivf" && !ivf) || (p.index_type == "hnsw" && !hnsw)) {
+        fprintf(stderr, "Invalid sweep point: %s,%s,%ld,%ld,%ld: index is not %s\n",
+                p.index_type.c_str(), p.index_file.c_str(), (long)p.nq, (long)p.param,
+                (long)p.k, p.index_type.c_str());
+        abort();
+      }
+      if (p.index_type == "ivf") {
+        ivf->nprobe = p.param;
+      } else if (p.index_type == "hnsw") {
+        hnsw->hnsw.efSearch = p.param;
+      }
+      p.nq = std::min(p.nq, data_query.n());
+      std::vector<faiss::idx_t> nns(p.k * p.nq);
+      std::vector<float> dis(p.k * p.nq);
+      LatencyReport report = measure_latency(
+        p.nq, batch_size, warmup, iterations, [&](int64_t q0, int64_t rows) {
+          ridx->search(rows, data_query.data() + q0 * data_query.dim(), p.k,
+                       dis.data() + q0 * p.k, nns.data() + q0 * p.k);
+        });
+      float recall = -1.0f;
+      if (!p.gt_file.empty()) {
+        auto &gt = gts[p.gt_file];
+        if (!gt) {
+          gt = std::make_unique<GroundTruthView>(p.gt_file);
+        }
+        recall = recall_at_k(nns.data(), *gt, p.nq, p.k);
+      }
+      writer.write(p, report, recall);
+      std::cout
+          << "[TIME] Search: [ index: " << index_file << " ][ # queries: " << p.nq
+          << " ][ param: " << p.param << " ][ k: " << p.k << " ]: " << report.best_us() << " us"
+          << std::endl;
+    }
+    delete ridx;
+  }
+  return 0;
+}
+
 int main(int argc, char **argv) {
   CLI::App app{"Run FAISS Benchmarks"};
   argv = app.ensure_utf8(argv);
@@ -81,6 +150,10 @@ int main(int argc, char **argv) {
   std::string calc_recall = "false";
   app.add_option("--calc-recall", calc_recall, "Calculate recall (true / false)");
 
+  std::string gt_file;
+  app.add_option("--gt-file", gt_file,
+                 "Ground truth written by run_gen_gt for the same learn vectors, used for recall");
+
   std::string dataset_dir;
   app.add_option("-d,--dataset-dir", dataset_dir, "Path to the dataset");
 
@@ -91,6 +164,14 @@ int main(int argc, char **argv) {
   app.add_option("--learn-limit", learn_limit,
                  "Limit the number of learn vectors");
 
+  int64_t io_threads = 0;
+  app.add_option("--io-threads", io_threads,
+                 "Read the learn vectors with this many parallel O_DIRECT readers (0 maps the file)");
+
+  int64_t learn_offset = 0;
+  app.add_option("--learn-offset", learn_offset,
+                 "Index of the first learn vector to use");
+
   int64_t search_limit = 10000;
   app.add_option("--search-limit", search_limit,
                  "Limit the number of search vectors");
@@ -107,9 +188,35 @@ int main(int argc, char **argv) {
   std::string dis_metric = "l2";
   app.add_option("--metric", dis_metric, "Distance metric to use (l2, ip)");
 
+  std::string centroids_file;
+  app.add_option("--centroids-file", centroids_file,
+                 "IVF centroids written by amx/run_kmeans, instead of faiss training");
+
   int64_t skip_build = 0;
   app.add_option("--skip-build", skip_build, "Skip building the index");
 
+  int64_t batch_size = 0;
+  app.add_option("--batch-size", batch_size,
+                 "Queries per search call, 1 for one at a time (0 searches all at once)");
+
+  int32_t warmup = 1;
+  app.add_option("--warmup", warmup, "Searches over all queries left out of the statistics");
+
+  int32_t iterations = 10;
+  app.add_option("--iterations", iterations, "Searches over all queries that are measured");
+
+  std::string perf_counters = "false";
+  app.add_option("--perf-counters", perf_counters,
+                 "Count cycles, instructions, LLC and dTLB misses of the load, search and recall (true / false)");
+
+  std::string sweep_file;
+  app.add_option("--sweep-file", sweep_file,
+                 "Search every (index_type,index_file,nq,param,k) point of this CSV file in one run");
+
+  std::string results_file = "sweep_results.csv";
+  app.add_option("--results-file", results_file,
+                 "Sweep results, CSV or JSON lines when ending in .json / .jsonl");
+
   CLI11_PARSE(app, argc, argv);
 
   if (dataset_dir.empty()) {
@@ -117,19 +224,38 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  if (!sweep_file.empty()) {
+    return run_sweep(read_sweep_points(sweep_file), dataset_dir, calc_recall == "true",
+                     gt_file, results_file, batch_size, warmup, iterations);
+  }
+
+  if (calc_recall == "true" && gt_file.empty()) {
+    std::cerr << "[ERROR] Recall needs a --gt-file from run_gen_gt" << std::endl;
+    return 1;
+  }
+
   if (!skip_build) {
     // Load the learn dataset
     std::string dataset_path_learn = dataset_dir + "/dataset.bin";
-    int64_t n_learn, dim_learn;
-    auto data_learn = read_bin_dataset(dataset_path_learn.c_str(), &n_learn, &dim_learn, learn_limit);
+    DatasetView data_learn(dataset_path_learn, learn_offset, learn_limit, MAP_ADVICE_DEFAULT, io_threads);
+    int64_t n_learn = data_learn.n(), dim_learn = data_learn.dim();
 
     // Print information about the learn dataset
     std::cout << "[INFO] Learn dataset shape: " << dim_learn << " x " << n_learn
               << std::endl;
-    preview_dataset(data_learn);
+    preview_dataset(data_learn.data());
 
     // Set parameters
     int64_t n_list = int64_t(4 * std::sqrt(n_learn));
+    std::vector<float> centroids;
+    if (index_type == "ivf" && !centroids_file.empty()) {
+      int64_t dim_centroids;
+      centroids = read_bin_dataset(centroids_file, &n_list, &dim_centroids, INT64_MAX);
+      if (dim_centroids != dim_learn) {
+        std::cerr << "[ERROR] Centroids do not match the dataset dimension" << std::endl;
+        return 1;
+      }
+    }
 
     // Create the index
     faiss::Index *widx;
@@ -137,7 +263,20 @@ int main(int argc, char **argv) {
       widx = CPU_create_hnsw_index(dim_learn, dis_metric);
     } else if (index_type == "ivf") {
       widx = CPU_create_ivf_index(dim_learn, n_list, dis_metric);
-      widx->train(n_learn, data_learn.data());
+      auto s = std::chrono::high_resolution_clock::now();
+      if (centroids.empty()) {
+        widx->train(n_learn, data_learn.data());
+      } else {
+        // Precomputed centroids become the coarse quantizer as is
+        auto ivf = dynamic_cast<faiss::IndexIVFFlat*>(widx);
+        ivf->quantizer->add(n_list, centroids.data());
+        ivf->is_trained = true;
+      }
+      auto e = std::chrono::high_resolution_clock::now();
+      std::cout
+          << "[TIME] Train: [ # lists: " << n_list << " ]: "
+          << std::chrono::duration_cast<std::chrono::milliseconds>(e - s).count()
+          << " ms" << std::endl;
     } else if (index_type == "flat") {
       widx = CPU_create_flat_index(dim_learn, dis_metric);
     } else {
@@ -159,8 +298,25 @@ int main(int argc, char **argv) {
   }
 
   if (skip_build) {
+    // Hardware counters, opened before the index is read so that they
+    // cover the threads of every phase
+    std::unique_ptr<PerfCounters> perf;
+    if (perf_counters == "true") {
+      perf = std::make_unique<PerfCounters>();
+      if (!perf->available()) {
+        std::cout << "[INFO] Perf: counters unavailable (" << perf->error() << ")" << std::endl;
+        perf.reset();
+      }
+    }
+
     // Read the index from disk
+    if (perf) {
+      perf->start();
+    }
     faiss::Index *ridx = faiss::read_index(index_file.c_str());
+    if (perf) {
+      print_perf(index_file, "load", perf->stop(), ridx->ntotal, "vector");
+    }
     if (index_type == "ivf") {
       dynamic_cast<faiss::IndexIVFFlat*>(ridx)->nprobe = n_probe;
     } else if (index_type == "hnsw") {
@@ -169,54 +325,49 @@ int main(int argc, char **argv) {
 
     // Load the search dataset
     std::string dataset_path_query = dataset_dir + "/query.bin";
-    int64_t n_query, dim_query;
-    auto data_query = read_bin_dataset(dataset_path_query.c_str(), &n_query, &dim_query, search_limit);
+    DatasetView data_query(dataset_path_query, 0, search_limit);
+    int64_t n_query = data_query.n(), dim_query = data_query.dim();
 
     // Print information about the search dataset
     std::cout << "[INFO] Query dataset shape: " << dim_query << " x " << n_query
               << std::endl;
-    preview_dataset(data_query);
+    preview_dataset(data_query.data());
+
+    // Map the ground truth before searching, so a bad file fails early
+    std::unique_ptr<GroundTruthView> gt;
+    if (calc_recall == "true") {
+      gt = std::make_unique<GroundTruthView>(gt_file);
+    }
 
     // Containers to hold the search results
     std::vector<faiss::idx_t> nns(top_k * n_query);
     std::vector<float> dis(top_k * n_query);
 
     // Perform the search
-    for (int itr = 0; itr < 10; itr++) {
-      auto s = std::chrono::high_resolution_clock::now();
-      ridx->search(n_query, data_query.data(), top_k, dis.data(), nns.data());
-      auto e = std::chrono::high_resolution_clock::now();
-      std::cout
-        << "[TIME] Search: [ index: " << index_file.c_str() << " ][ # queries: " << n_query << " ]: "
-        << std::chrono::duration_cast<std::chrono::microseconds>(e - s).count()
-        << " us" << std::endl;
+    if (perf) {
+      perf->start();
     }
-    
+    LatencyReport report = measure_latency(
+      n_query, batch_size, warmup, iterations, [&](int64_t q0, int64_t rows) {
+        ridx->search(rows, data_query.data() + q0 * dim_query, top_k,
+                     dis.data() + q0 * top_k, nns.data() + q0 * top_k);
+      });
+    if (perf) {
+      // Warmup passes included
+      print_perf(index_file, "search", perf->stop(), report.queries + (int64_t)warmup * n_query);
+    }
+    print_latency(index_file, report);
+
     delete ridx;
 
     if (calc_recall == "true") {
-      std::string dataset_path_learn = dataset_dir + "/dataset.bin";
-      int64_t n_learn, dim_learn;
-      auto data_learn = read_bin_dataset(dataset_path_learn.c_str(), &n_learn, &dim_learn, learn_limit);
-
-      std::string mem_type = "cuda";
-      auto provider = new faiss::gpu::StandardGpuResources();
-      faiss::Index *gt_idx = GPU_create_flat_index(dim_learn, mem_type, provider, 0);
-      gt_idx->add(n_learn, data_learn.data());
-      std::vector<faiss::idx_t> gt_nns(top_k * n_query);
-      std::vector<float> gt_dis(top_k * n_query);
-      gt_idx->search(n_query, data_query.data(), top_k, gt_dis.data(), gt_nns.data());
-      int64_t recalls = 0;
-      for (int64_t i = 0; i < n_query; ++i) {
-        for (int64_t n = 0; n < top_k; n++) {
-          for (int64_t m = 0; m < top_k; m++) {
-            if (nns[i * top_k + n] == gt_nns[i * top_k + m]) {
-              recalls += 1;
-            }
-          }
-        }
+      if (perf) {
+        perf->start();
+      }
+      float recall = recall_at_k(nns.data(), *gt, n_query, top_k);
+      if (perf) {
+        print_perf(index_file, "recall", perf->stop(), n_query);
       }
-      float recall = 1.0f * recalls / (top_k * n_query);
       std::cout << "[INFO] Recall@" << top_k << ": " << recall << std::endl;
     }
   }
@@ -0,0 +1,25 @@
+#!/bin/bash
+set -e
+
+export LD_LIBRARY_PATH=/usr/local/lib:$LD_LIBRARY_PATH
+
+# The run_cpu_index.sh matrix in a single process: every index is read
+# once, recall uses the run_gen_gt.sh ground truth of its learn set size
+SWEEP_FILE=sweep_cpu.csv
+GT_DIR=/workspace/dataset/t2i
+
+echo "index_type,index_file,nq,param,k,gt_file" > ${SWEEP_FILE}
+for point in "100000 32 32" "1000000 48 96" "10000000 64 512"; do
+    set -- ${point}
+    for nq in 10 100 1000 10000; do
+        echo "flat,cpu_flat_${1}l.faiss,${nq},0,10,${GT_DIR}/gt_${1}l_10000q_10k.bin" >> ${SWEEP_FILE}
+        echo "ivf,cpu_ivf_${1}l.faiss,${nq},${2},10,${GT_DIR}/gt_${1}l_10000q_10k.bin" >> ${SWEEP_FILE}
+        echo "hnsw,cpu_hnsw_${1}l.faiss,${nq},${3},10,${GT_DIR}/gt_${1}l_10000q_10k.bin" >> ${SWEEP_FILE}
+    done
+done
+
+./run_cpu \
+    --dataset-dir /workspace/dataset/t2i \
+    --sweep-file ${SWEEP_FILE} \
+    --results-file sweep_cpu_results.csv \
+    --calc-recall true
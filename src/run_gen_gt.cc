@@ -1,43 +1,67 @@
+#include <chrono>
 #include <cmath>
+#include <cstdio>
 #include <iostream>
 #include <vector>
 
 #include "CLI11.hpp"
-#include <faiss/gpu/GpuIndexFlat.h>
-#include <faiss/gpu/StandardGpuResources.h>
-#include <faiss/index_io.h>
+#include <faiss/utils/distances.h>
 
 #include "utils.h"
 
 /**
- * @brief Create a Flat index using the GPU
- *
- * @param dim The dimension of the vectors
- * @param mem_type The memory type to use
- * @param provider The GPU resources provider
- * @param cuda_device The CUDA device to use
+ * @brief Progress of a ground truth file being written, kept next to it in
+ * <gt file>.progress. A later run with the same inputs resumes after the
+ * last query block that reached the disk. The inputs include the dataset
+ * directory and the row counts and dimension of its files, so a run
+ * against another dataset of the same slice sizes starts over.
  */
-faiss::Index *GPU_create_flat_index(int64_t dim, std::string mem_type,
-                                    faiss::gpu::GpuResourcesProvider *provider,
-                                    int64_t cuda_device) {
-  auto config = faiss::gpu::GpuIndexConfig();
-  config.device = cuda_device;
-  config.memorySpace = (mem_type == "cuda") ? faiss::gpu::MemorySpace::Device
-                                            : faiss::gpu::MemorySpace::Unified;
-  auto index = new faiss::gpu::GpuIndexFlatIP(
-      provider, dim, faiss::gpu::GpuIndexFlatConfig{config});
-  return index;
+struct GroundTruthProgress {
+  uint64_t dataset_hash;
+  int64_t learn_file_n;
+  int64_t query_file_n;
+  int64_t dim;
+  int64_t n_learn;
+  int64_t learn_offset;
+  int64_t n_query;
+  int64_t top_k;
+  int64_t metric_l2;
+  int64_t done;
+};
+
+bool same_inputs(const GroundTruthProgress &a, const GroundTruthProgress &b) {
+  return a.dataset_hash == b.dataset_hash && a.learn_file_n == b.learn_file_n &&
+         a.query_file_n == b.query_file_n && a.dim == b.dim &&
+         a.n_learn == b.n_learn && a.learn_offset == b.learn_offset &&
+         a.n_query == b.n_query && a.top_k == b.top_k && a.metric_l2 == b.metric_l2;
 }
 
-int main(int argc, char **argv) {
-  CLI::App app{"Run FAISS Benchmarks"};
-  argv = app.ensure_utf8(argv);
+// FNV-1a, stable across builds unlike std::hash
+uint64_t hash_path(const std::string &path) {
+  uint64_t h = 14695981039346656037ull;
+  for (unsigned char c : path) {
+    h = (h ^ c) * 1099511628211ull;
+  }
+  return h;
+}
 
-  std::string mem_type = "cuda";
-  app.add_option("--mem-type", mem_type, "Memory type: cuda or managed");
+// Replace the progress file in one step, so a crash leaves the old or the
+// new one
+void write_progress(const std::string &fname, const GroundTruthProgress &progress) {
+  std::string tmp = fname + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "w");
+  if (!f || fwrite(&progress, sizeof(progress), 1, f) != 1 || fflush(f) != 0 ||
+      fsync(fileno(f)) != 0) {
+    fprintf(stderr, "Could not write %s\n", tmp.c_str());
+    abort();
+  }
+  fclose(f);
+  rename(tmp.c_str(), fname.c_str());
+}
 
-  int64_t cuda_device = 0;
-  app.add_option("--cuda-device", cuda_device, "The CUDA device to use");
+int main(int argc, char **argv) {
+  CLI::App app{"Generate exact ground truth on the CPU"};
+  argv = app.ensure_utf8(argv);
 
   std::string dataset_dir;
   app.add_option("-d,--dataset-dir", dataset_dir, "Path to the dataset");
@@ -46,6 +70,14 @@ int main(int argc, char **argv) {
   app.add_option("--learn-limit", learn_limit,
                  "Limit the number of learn vectors");
 
+  int64_t io_threads = 0;
+  app.add_option("--io-threads", io_threads,
+                 "Read the learn vectors with this many parallel O_DIRECT readers (0 maps the file)");
+
+  int64_t learn_offset = 0;
+  app.add_option("--learn-offset", learn_offset,
+                 "Index of the first learn vector to use");
+
   int64_t search_limit = 10000;
   app.add_option("--search-limit", search_limit,
                  "Limit the number of search vectors");
@@ -53,6 +85,18 @@ int main(int argc, char **argv) {
   int64_t top_k = 10;
   app.add_option("-k,--top-k", top_k, "Number of nearest neighbors");
 
+  std::string dis_metric = "ip";
+  app.add_option("--metric", dis_metric, "Distance metric to use (ip, l2)");
+
+  std::string gt_file;
+  app.add_option("--gt-file", gt_file,
+                 "Output ground truth in the big-ann-benchmarks format "
+                 "(default gt_<learn>l_<queries>q_<k>k.bin in the dataset directory)");
+
+  int64_t query_block = 10000;
+  app.add_option("--query-block", query_block,
+                 "Number of queries searched and checkpointed at a time");
+
   CLI11_PARSE(app, argc, argv);
 
   if (dataset_dir.empty()) {
@@ -60,29 +104,86 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  auto provider = new faiss::gpu::StandardGpuResources();
+  if (dis_metric != "ip" && dis_metric != "l2") {
+    std::cerr << "[ERROR] Invalid metric" << std::endl;
+    return 1;
+  }
 
   std::string dataset_path_learn = dataset_dir + "/dataset.bin";
-  int64_t n_learn, dim_learn;
-  auto data_learn = read_bin_dataset(dataset_path_learn.c_str(), &n_learn, &dim_learn, learn_limit);
+  DatasetView data_learn(dataset_path_learn, learn_offset, learn_limit, MAP_ADVICE_DEFAULT, io_threads);
+  int64_t n_learn = data_learn.n(), dim_learn = data_learn.dim();
 
   std::string dataset_path_query = dataset_dir + "/query.bin";
-  int64_t n_query, dim_query;
-  auto data_query = read_bin_dataset(dataset_path_query.c_str(), &n_query, &dim_query, search_limit);
+  DatasetView data_query(dataset_path_query, 0, search_limit);
+  int64_t n_query = data_query.n(), dim_query = data_query.dim();
+
+  if (gt_file.empty()) {
+    gt_file = dataset_dir + "/gt_" + std::to_string(n_learn) + "l_" +
+              std::to_string(n_query) + "q_" + std::to_string(top_k) + "k.bin";
+  }
 
-  faiss::Index *gt_idx_gpu = GPU_create_flat_index(dim_learn, mem_type, provider, cuda_device);
-  gt_idx_gpu->add(n_learn, data_learn.data());
-      
-  std::vector<faiss::idx_t> gt_nns(top_k * n_query);
-  std::vector<float> gt_dis(top_k * n_query);
-      
-  gt_idx_gpu->search(n_query, data_query.data(), top_k, gt_dis.data(), gt_nns.data());
+  // Resume from the progress file if it was written for the same inputs,
+  // otherwise start a fresh file of the final size
+  std::string progress_file = gt_file + ".progress";
+  char *dataset_real = realpath(dataset_dir.c_str(), nullptr);
+  GroundTruthProgress progress{hash_path(dataset_real ? dataset_real : dataset_dir),
+                               data_learn.file_n(), data_query.file_n(), dim_learn,
+                               n_learn, learn_offset, n_query, top_k, dis_metric == "l2", 0};
+  free(dataset_real);
+  GroundTruthProgress saved;
+  FILE *pf = fopen(progress_file.c_str(), "r");
+  bool resume = pf && fread(&saved, sizeof(saved), 1, pf) == 1 && same_inputs(saved, progress);
+  if (pf) {
+    fclose(pf);
+  }
+  GroundTruthWriter writer(gt_file, n_query, top_k, resume);
+  if (resume) {
+    progress.done = saved.done;
+    std::cout << "[INFO] Resuming " << gt_file << " after " << progress.done << " queries"
+              << std::endl;
+  } else {
+    write_progress(progress_file, progress);
+  }
+
+  std::vector<int64_t> nns(query_block * top_k);
+  std::vector<float> dis(query_block * top_k);
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int64_t qb = progress.done; qb < n_query; qb += query_block) {
+    int64_t rows = std::min(query_block, n_query - qb);
+    auto s = std::chrono::high_resolution_clock::now();
+    // faiss blocks the queries and the learn set, scores each pair of
+    // blocks with one GEMM and keeps per-query heaps, over all threads
+    const float *q = data_query.data() + qb * dim_query;
+    if (dis_metric == "l2") {
+      faiss::knn_L2sqr(q, data_learn.data(), dim_learn, rows, n_learn, top_k,
+                       dis.data(), nns.data());
+    } else {
+      faiss::knn_inner_product(q, data_learn.data(), dim_learn, rows, n_learn, top_k,
+                               dis.data(), nns.data());
+    }
+    writer.write_block(qb, rows, nns.data(), dis.data());
+    progress.done = qb + rows;
+    write_progress(progress_file, progress);
+    auto e = std::chrono::high_resolution_clock::now();
+    std::cout
+        << "[TIME] Ground truth: [ queries: " << qb << " - " << qb + rows << " of " << n_query
+        << " ]: " << std::chrono::duration_cast<std::chrono::milliseconds>(e - s).count()
+        << " ms" << std::endl;
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  std::remove(progress_file.c_str());
+  std::cout
+      << "[TIME] Ground truth: [ learn: " << n_learn << " ][ queries: " << n_query << " ]: "
+      << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
+      << " ms" << std::endl;
+  std::cout << "[INFO] Wrote " << gt_file << std::endl;
 
   // Preview ground truth
-  for (int i = 0; i < 10; i++) {
+  GroundTruthView gt(gt_file);
+  for (int i = 0; i < std::min<int64_t>(10, gt.n()); i++) {
     std::cout << "Query " << i << ": ";
-    for (int j = 0; j < top_k; j++) {
-      std::cout << gt_nns[i * top_k + j] << " ";
+    for (int j = 0; j < gt.k(); j++) {
+      std::cout << gt.ids(i)[j] << " ";
     }
     std::cout << std::endl;
   }
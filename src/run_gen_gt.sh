@@ -3,9 +3,13 @@ set -e
 
 export LD_LIBRARY_PATH=/usr/local/lib:$LD_LIBRARY_PATH
 
+# Parallel O_DIRECT readers for the learn set; 0 maps it instead
+IO_THREADS=${IO_THREADS:-16}
+
 run_gen_gt() {
     ./run_gen_gt \
         --dataset-dir /workspace/dataset/t2i \
+        --io-threads ${IO_THREADS} \
         --learn-limit ${1} \
         --search-limit ${2} \
         --top-k 10
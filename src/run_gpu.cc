@@ -1,6 +1,7 @@
 #include <chrono>
 #include <cmath>
 #include <iostream>
+#include <memory>
 #include <vector>
 
 #include "CLI11.hpp"
@@ -11,6 +12,7 @@
 #include <faiss/index_io.h>
 
 #include "utils.h"
+#include "timing.h"
 
 /**
  * @brief Create a Flat index using the GPU
@@ -72,6 +74,10 @@ int main(int argc, char **argv) {
   std::string calc_recall = "false";
   app.add_option("--calc-recall", calc_recall, "Calculate recall (true / false)");
 
+  std::string gt_file;
+  app.add_option("--gt-file", gt_file,
+                 "Ground truth written by run_gen_gt for the same learn vectors, used for recall");
+
   std::string dataset_dir;
   app.add_option("-d,--dataset-dir", dataset_dir, "Path to the dataset");
 
@@ -82,6 +88,14 @@ int main(int argc, char **argv) {
   app.add_option("--learn-limit", learn_limit,
                  "Limit the number of learn vectors");
 
+  int64_t io_threads = 0;
+  app.add_option("--io-threads", io_threads,
+                 "Read the learn vectors with this many parallel O_DIRECT readers (0 maps the file)");
+
+  int64_t learn_offset = 0;
+  app.add_option("--learn-offset", learn_offset,
+                 "Index of the first learn vector to use");
+
   int64_t search_limit = 10000;
   app.add_option("--search-limit", search_limit,
                  "Limit the number of search vectors");
@@ -102,6 +116,16 @@ int main(int argc, char **argv) {
   int64_t skip_build = 0;
   app.add_option("--skip-build", skip_build, "Skip building the index");
 
+  int64_t batch_size = 0;
+  app.add_option("--batch-size", batch_size,
+                 "Queries per search call, 1 for one at a time (0 searches all at once)");
+
+  int32_t warmup = 1;
+  app.add_option("--warmup", warmup, "Searches over all queries left out of the statistics");
+
+  int32_t iterations = 10;
+  app.add_option("--iterations", iterations, "Searches over all queries that are measured");
+
   CLI11_PARSE(app, argc, argv);
 
   if (dataset_dir.empty()) {
@@ -109,19 +133,24 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  if (calc_recall == "true" && gt_file.empty()) {
+    std::cerr << "[ERROR] Recall needs a --gt-file from run_gen_gt" << std::endl;
+    return 1;
+  }
+
   // Preparing GPU resources
   auto provider = new faiss::gpu::StandardGpuResources();
 
   if (!skip_build) {
     // Load the learn dataset
     std::string dataset_path_learn = dataset_dir + "/dataset.bin";
-    int64_t n_learn, dim_learn;
-    auto data_learn = read_bin_dataset(dataset_path_learn.c_str(), &n_learn, &dim_learn, learn_limit);
+    DatasetView data_learn(dataset_path_learn, learn_offset, learn_limit, MAP_ADVICE_DEFAULT, io_threads);
+    int64_t n_learn = data_learn.n(), dim_learn = data_learn.dim();
 
     // Print information about the learn dataset
     std::cout << "[INFO] Learn dataset shape: " << dim_learn << " x " << n_learn
               << std::endl;
-    preview_dataset(data_learn);
+    preview_dataset(data_learn.data());
 
     // Set parameters
     int64_t n_list = int64_t(4 * std::sqrt(n_learn));
@@ -163,53 +192,37 @@ int main(int argc, char **argv) {
 
     // Load the search dataset
     std::string dataset_path_query = dataset_dir + "/query.bin";
-    int64_t n_query, dim_query;
-    auto data_query = read_bin_dataset(dataset_path_query.c_str(), &n_query, &dim_query, search_limit);
+    DatasetView data_query(dataset_path_query, 0, search_limit);
+    int64_t n_query = data_query.n(), dim_query = data_query.dim();
 
     // Print information about the search dataset
     std::cout << "[INFO] Query dataset shape: " << dim_query << " x " << n_query
               << std::endl;
-    preview_dataset(data_query);
+    preview_dataset(data_query.data());
+
+    // Map the ground truth before searching, so a bad file fails early
+    std::unique_ptr<GroundTruthView> gt;
+    if (calc_recall == "true") {
+      gt = std::make_unique<GroundTruthView>(gt_file);
+    }
 
     // Containers to hold the search results
     std::vector<faiss::idx_t> nns(top_k * n_query);
     std::vector<float> dis(top_k * n_query);
 
     // Perform the search
-    for (int i = 0; i < 10; i++) {
-      auto s = std::chrono::high_resolution_clock::now();
-      ridx_gpu->search(n_query, data_query.data(), top_k, dis.data(), nns.data());
-      auto e = std::chrono::high_resolution_clock::now();
-      std::cout
-          << "[TIME] Search: [ index: " << index_file.c_str() << " ][ # queries: " << n_query << " ]: "
-          << std::chrono::duration_cast<std::chrono::microseconds>(e - s).count()
-          << " us" << std::endl; 
-    }
+    LatencyReport report = measure_latency(
+      n_query, batch_size, warmup, iterations, [&](int64_t q0, int64_t rows) {
+        ridx_gpu->search(rows, data_query.data() + q0 * dim_query, top_k,
+                         dis.data() + q0 * top_k, nns.data() + q0 * top_k);
+      });
+    print_latency(index_file, report);
 
     delete ridx_cpu;
     delete ridx_gpu;
 
     if (calc_recall == "true") {
-      std::string dataset_path_learn = dataset_dir + "/dataset.bin";
-      int64_t n_learn, dim_learn;
-      auto data_learn = read_bin_dataset(dataset_path_learn.c_str(), &n_learn, &dim_learn, learn_limit);
-
-      faiss::Index *gt_idx_gpu = GPU_create_flat_index(dim_learn, mem_type, provider, cuda_device);
-      gt_idx_gpu->add(n_learn, data_learn.data());
-      std::vector<faiss::idx_t> gt_nns(top_k * n_query);
-      std::vector<float> gt_dis(top_k * n_query);
-      gt_idx_gpu->search(n_query, data_query.data(), top_k, gt_dis.data(), gt_nns.data());
-      int64_t recalls = 0;
-      for (int64_t i = 0; i < n_query; ++i) {
-        for (int64_t n = 0; n < top_k; n++) {
-          for (int64_t m = 0; m < top_k; m++) {
-            if (nns[i * top_k + n] == gt_nns[i * top_k + m]) {
-              recalls += 1;
-            }
-          }
-        }
-      }
-      float recall = 1.0f * recalls / (top_k * n_query);
+      float recall = recall_at_k(nns.data(), *gt, n_query, top_k);
       std::cout << "[INFO] Recall@" << top_k << ": " << recall << std::endl;
     }
   }
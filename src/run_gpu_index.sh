@@ -3,16 +3,21 @@ set -e
 
 export LD_LIBRARY_PATH=/usr/local/lib:$LD_LIBRARY_PATH
 
+# Parallel O_DIRECT readers for the learn set; 0 maps it instead
+IO_THREADS=${IO_THREADS:-16}
+
 run_flat() {
     ./run_gpu \
         --index-type flat \
         --dataset-dir /workspace/dataset/t2i \
+        --io-threads ${IO_THREADS} \
         --learn-limit ${1} \
         --search-limit ${2} \
         --top-k 10 \
         --metric ip \
         --skip-build 1 \
         --index-file gpu_flat_${1}l.faiss \
+        --gt-file /workspace/dataset/t2i/gt_${1}l_10000q_10k.bin \
         --calc-recall true
 }
 
@@ -20,6 +25,7 @@ run_ivf() {
     ./run_gpu \
         --index-type ivf \
         --dataset-dir /workspace/dataset/t2i \
+        --io-threads ${IO_THREADS} \
         --learn-limit ${1} \
         --search-limit ${2} \
         --top-k 10 \
@@ -27,6 +33,7 @@ run_ivf() {
         --metric ip \
         --skip-build 1 \
         --index-file gpu_ivf_${1}l.faiss \
+        --gt-file /workspace/dataset/t2i/gt_${1}l_10000q_10k.bin \
         --calc-recall true
 }
 
@@ -0,0 +1,122 @@
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "timing.h"
+
+/**
+ * @brief One benchmark point of a sweep: an index file searched with nq
+ * queries for the top k, where param is nprobe for ivf, ef for hnsw and
+ * unused for flat. gt_file, when set, is the ground truth recall is
+ * measured against.
+ */
+struct SweepPoint {
+  std::string index_type;
+  std::string index_file;
+  int64_t nq;
+  int64_t param;
+  int64_t k;
+  std::string gt_file;
+};
+
+/**
+ * @brief Read sweep points from a CSV file with the header
+ * index_type,index_file,nq,param,k and an optional gt_file column. Blank
+ * lines and lines starting with # are skipped.
+ */
+std::vector<SweepPoint> read_sweep_points(std::string fname) {
+  std::ifstream file(fname);
+  if (!file) {
+    fprintf(stderr, "Could not open %s\n", fname.c_str());
+    abort();
+  }
+  std::vector<SweepPoint> points;
+  std::string line;
+  bool header = true;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    if (header) {
+      header = false;
+      continue;
+    }
+    std::stringstream fields(line);
+    SweepPoint p;
+    std::string nq, param, k;
+    if (!std::getline(fields, p.index_type, ',') || !std::getline(fields, p.index_file, ',') ||
+        !std::getline(fields, nq, ',') || !std::getline(fields, param, ',') ||
+        !std::getline(fields, k, ',')) {
+      fprintf(stderr, "Invalid sweep point: %s\n", line.c_str());
+      abort();
+    }
+    std::getline(fields, p.gt_file, ',');
+    p.nq = std::stoll(nq);
+    p.param = std::stoll(param);
+    p.k = std::stoll(k);
+    points.push_back(p);
+  }
+  return points;
+}
+
+/**
+ * @brief Writes one result row per sweep point as it completes, as CSV, or
+ * as JSON lines when the file name ends in .json or .jsonl. Every row is
+ * flushed, so a partial sweep still leaves usable results. qps is the mean
+ * over the measured iterations and the pNN_us columns are per-query latency
+ * percentiles. A negative recall means it was not computed.
+ */
+class SweepWriter {
+  std::ofstream _file;
+  bool _json;
+
+public:
+  explicit SweepWriter(std::string fname) : _file(fname) {
+    if (!_file) {
+      fprintf(stderr, "Could not open %s\n", fname.c_str());
+      abort();
+    }
+    auto ends_with = [&](const std::string &suffix) {
+      return fname.size() >= suffix.size() &&
+             fname.compare(fname.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+    _json = ends_with(".json") || ends_with(".jsonl");
+    if (!_json) {
+      _file << "index_type,index_file,nq,param,k,batch,best_us,mean_us,qps,"
+            << "p50_us,p90_us,p99_us,p999_us,recall" << std::endl;
+    }
+  }
+
+  void write(const SweepPoint &p, const LatencyReport &report, float recall) {
+    const LatencyHistogram &h = report.latency;
+    if (_json) {
+      _file << "{\"index_type\": \"" << p.index_type << "\", \"index_file\": \"" << p.index_file
+            << "\", \"nq\": " << p.nq << ", \"param\": " << p.param << ", \"k\": " << p.k
+            << ", \"batch\": " << report.batch_size << ", \"best_us\": " << report.best_us()
+            << ", \"mean_us\": " << report.mean_us() << ", \"qps\": " << report.qps()
+            << ", \"p50_us\": " << h.percentile_ns(50) / 1e3
+            << ", \"p90_us\": " << h.percentile_ns(90) / 1e3
+            << ", \"p99_us\": " << h.percentile_ns(99) / 1e3
+            << ", \"p999_us\": " << h.percentile_ns(99.9) / 1e3 << ", \"recall\": ";
+      if (recall < 0) {
+        _file << "null";
+      } else {
+        _file << recall;
+      }
+      _file << "}" << std::endl;
+    } else {
+      _file << p.index_type << "," << p.index_file << "," << p.nq << "," << p.param << ","
+            << p.k << "," << report.batch_size << "," << report.best_us() << ","
+            << report.mean_us() << "," << report.qps() << "," << h.percentile_ns(50) / 1e3 << ","
+            << h.percentile_ns(90) / 1e3 << "," << h.percentile_ns(99) / 1e3 << ","
+            << h.percentile_ns(99.9) / 1e3 << ",";
+      if (recall >= 0) {
+        _file << recall;
+      }
+      _file << std::endl;
+    }
+  }
+};
@@ -1,8 +1,16 @@
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <thread>
+#include <unistd.h>
 
-void preview_dataset(std::vector<float> xb) {
+void preview_dataset(const float *xb) {
   for (int64_t i = 0; i < 5; i++) {
     for (int64_t j = 0; j < 10; j++) {
       std::cout << xb[i * 10 + j] << " ";
@@ -11,6 +19,10 @@ void preview_dataset(std::vector<float> xb) {
   }
 }
 
+void preview_dataset(const std::vector<float> &xb) {
+  preview_dataset(xb.data());
+}
+
 void write_vector(const char *filename, int64_t *data, int64_t size) {
   FILE *f = fopen(filename, "w");
   if (!f) {
@@ -59,3 +71,348 @@ std::vector<float> read_bin_dataset(std::string fname, int64_t *n, int64_t *d,
 
   return data;
 }
+
+// madvise() hints applied to a DatasetView, combined with |
+enum MapAdvice : unsigned {
+  MAP_ADVICE_NONE = 0,
+  MAP_ADVICE_SEQUENTIAL = 1,
+  MAP_ADVICE_WILLNEED = 2,
+  MAP_ADVICE_HUGEPAGE = 4,
+  MAP_ADVICE_DEFAULT = MAP_ADVICE_SEQUENTIAL | MAP_ADVICE_WILLNEED | MAP_ADVICE_HUGEPAGE,
+};
+
+/**
+ * @brief Read-only view of rows [offset, offset + limit) of a file in the
+ * read_bin_dataset() layout, mapped instead of copied.
+ *
+ * Only the pages of those rows are mapped, and nothing is read until it is
+ * touched, so opening even a large slice is a matter of milliseconds. With
+ * MAP_ADVICE_WILLNEED the kernel starts reading the slice in the background
+ * right away. The rows stay valid for the lifetime of the view.
+ *
+ * With io_threads > 0 the rows are instead read up front into anonymous
+ * memory, for data that is not in the page cache: the range is split into
+ * aligned extents that io_threads readers fetch concurrently with O_DIRECT
+ * (buffered reads where the filesystem refuses it). The readers are not
+ * pinned, so the pages land on whichever NUMA nodes the scheduler happened
+ * to run them on.
+ */
+class DatasetView {
+  void *_map = MAP_FAILED;
+  size_t _map_size = 0;
+  const float *_data = nullptr;
+  int64_t _n = 0;
+  int64_t _dim = 0;
+  int64_t _file_n = 0;
+
+  static constexpr int64_t DIRECT_ALIGN = 4096;
+  static constexpr int64_t DIRECT_EXTENT = 16 << 20;
+
+public:
+  DatasetView(std::string fname, int64_t offset, int64_t limit,
+              unsigned advice = MAP_ADVICE_DEFAULT, int32_t io_threads = 0) {
+    int fd = open(fname.c_str(), O_RDONLY);
+    uint32_t header[2];
+    if (fd < 0 || pread(fd, header, sizeof(header), 0) != sizeof(header)) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      throw std::runtime_error("Could not read " + fname);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        st.st_size < (off_t)(sizeof(header) + (int64_t)header[0] * header[1] * sizeof(float))) {
+      close(fd);
+      throw std::runtime_error("Truncated dataset file " + fname);
+    }
+    offset = std::min(std::max(offset, (int64_t)0), (int64_t)header[0]);
+    _n = std::min((int64_t)header[0] - offset, limit);
+    _dim = header[1];
+    _file_n = header[0];
+
+    int64_t start = sizeof(header) + offset * _dim * sizeof(float);
+    if (io_threads > 0) {
+      close(fd);
+      read_direct(fname, start, io_threads);
+      return;
+    }
+
+    // mmap() needs a page aligned file offset
+    int64_t page = sysconf(_SC_PAGESIZE);
+    int64_t map_start = start / page * page;
+    _map_size = start - map_start + _n * _dim * sizeof(float);
+    if (_map_size > 0) {
+      _map = mmap(nullptr, _map_size, PROT_READ, MAP_PRIVATE, fd, map_start);
+    }
+    close(fd);
+    if (_map_size > 0 && _map == MAP_FAILED) {
+      throw std::runtime_error("Could not map " + fname);
+    }
+    if (_map != MAP_FAILED) {
+      _data = reinterpret_cast<const float *>(static_cast<char *>(_map) + (start - map_start));
+      if (advice & MAP_ADVICE_SEQUENTIAL) {
+        madvise(_map, _map_size, MADV_SEQUENTIAL);
+      }
+      if (advice & MAP_ADVICE_WILLNEED) {
+        madvise(_map, _map_size, MADV_WILLNEED);
+      }
+#ifdef MADV_HUGEPAGE
+      // Only honored where the kernel backs file mappings with huge pages
+      if (advice & MAP_ADVICE_HUGEPAGE) {
+        madvise(_map, _map_size, MADV_HUGEPAGE);
+      }
+#endif
+    }
+    printf("[INFO] Mapped file - N:%li, dim:%li, offset:%li\n", _n, _dim, offset);
+  }
+
+  ~DatasetView() {
+    if (_map != MAP_FAILED) {
+      munmap(_map, _map_size);
+    }
+  }
+
+private:
+  /**
+   * @brief Read the rows starting at file offset start with io_threads
+   * concurrent readers, each taking the next DIRECT_EXTENT bytes in turn.
+   */
+  void read_direct(const std::string &fname, int64_t start, int32_t io_threads) {
+    // O_DIRECT needs offsets, lengths and the buffer aligned to the logical
+    // block size, so whole aligned blocks around the rows are read
+    int64_t bytes = _n * _dim * sizeof(float);
+    if (bytes == 0) {
+      return;
+    }
+    int64_t read_start = start / DIRECT_ALIGN * DIRECT_ALIGN;
+    _map_size = (start + bytes + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN - read_start;
+    _map = mmap(nullptr, _map_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (_map == MAP_FAILED) {
+      throw std::runtime_error("Could not allocate " + std::to_string(_map_size) + " bytes");
+    }
+    _data = reinterpret_cast<const float *>(static_cast<char *>(_map) + (start - read_start));
+    // The file may end inside the last aligned block, but not before the
+    // last requested row
+    int64_t rows_end = start + bytes - read_start;
+
+    int direct_fd = open(fname.c_str(), O_RDONLY | O_DIRECT);
+    int buffered_fd = open(fname.c_str(), O_RDONLY);
+    std::atomic<bool> direct{direct_fd >= 0};
+    std::atomic<int64_t> next_extent{0};
+    std::atomic<bool> failed{false};
+    int64_t n_extents = ((int64_t)_map_size + DIRECT_EXTENT - 1) / DIRECT_EXTENT;
+
+    auto s = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> readers;
+    for (int32_t t = 0; t < io_threads; t++) {
+      readers.emplace_back([&]() {
+        for (int64_t e = next_extent++; e < n_extents && !failed; e = next_extent++) {
+          int64_t pos = e * DIRECT_EXTENT;
+          int64_t end = std::min<int64_t>(pos + DIRECT_EXTENT, _map_size);
+          while (pos < end) {
+            char *dst = static_cast<char *>(_map) + pos;
+            ssize_t got = direct ? pread(direct_fd, dst, end - pos, read_start + pos)
+                                 : pread(buffered_fd, dst, end - pos, read_start + pos);
+            if (got < 0 && errno == EINVAL && direct) {
+              direct = false;
+              continue;
+            }
+            if (got < 0 || (got == 0 && pos < rows_end)) {
+              failed = true;
+            }
+            if (got <= 0) {
+              break;
+            }
+            pos += got;
+          }
+        }
+      });
+    }
+    for (std::thread &reader : readers) {
+      reader.join();
+    }
+    auto e = std::chrono::high_resolution_clock::now();
+    if (direct_fd >= 0) {
+      close(direct_fd);
+    }
+    close(buffered_fd);
+    if (failed) {
+      throw std::runtime_error("Could not read " + fname);
+    }
+    mprotect(_map, _map_size, PROT_READ);
+
+    double seconds = std::chrono::duration<double>(e - s).count();
+    printf("[INFO] Read in file - N:%li, dim:%li, %.2f GB/s with %d %s readers\n", _n, _dim,
+           _map_size / seconds / 1e9, io_threads, direct ? "O_DIRECT" : "buffered");
+  }
+
+public:
+  DatasetView(const DatasetView &) = delete;
+  DatasetView &operator=(const DatasetView &) = delete;
+
+  const float *data() const { return _data; }
+  int64_t n() const { return _n; }
+  int64_t dim() const { return _dim; }
+  // Rows in the whole file, from its header
+  int64_t file_n() const { return _file_n; }
+
+  // Copy of the rows, for code that needs to own or modify them
+  std::vector<float> to_vector() const {
+    return std::vector<float>(_data, _data + _n * _dim);
+  }
+};
+
+/**
+ * Ground truth files use the big-ann-benchmarks layout:
+ *
+ *   uint32 n, uint32 k
+ *   n x k int32 neighbor ids, best first per query
+ *   n x k float distances
+ */
+
+/**
+ * @brief Writes a ground truth file one block of queries at a time, at the
+ * final offsets of each block, so blocks can be written (and resumed) in
+ * order without keeping the whole result in memory.
+ */
+class GroundTruthWriter {
+  int _fd;
+  int64_t _n;
+  int64_t _k;
+
+public:
+  // With resume, keep the blocks an earlier run already wrote
+  GroundTruthWriter(std::string fname, int64_t n, int64_t k, bool resume) : _n(n), _k(k) {
+    _fd = open(fname.c_str(), O_RDWR | O_CREAT | (resume ? 0 : O_TRUNC), 0644);
+    if (_fd < 0) {
+      fprintf(stderr, "Could not open %s\n", fname.c_str());
+      perror("");
+      abort();
+    }
+    uint32_t header[2] = {(uint32_t)n, (uint32_t)k};
+    if (pwrite(_fd, header, sizeof(header), 0) != sizeof(header) ||
+        ftruncate(_fd, sizeof(header) + n * k * (sizeof(int32_t) + sizeof(float))) != 0) {
+      fprintf(stderr, "Could not write %s\n", fname.c_str());
+      abort();
+    }
+  }
+
+  ~GroundTruthWriter() {
+    close(_fd);
+  }
+
+  // Write the results of queries [q0, q0 + rows) and flush them to disk
+  void write_block(int64_t q0, int64_t rows, const int64_t *ids, const float *dis) {
+    std::vector<int32_t> ids32(ids, ids + rows * _k);
+    int64_t ids_offset = 2 * sizeof(uint32_t) + q0 * _k * sizeof(int32_t);
+    int64_t dis_offset = 2 * sizeof(uint32_t) + _n * _k * sizeof(int32_t) + q0 * _k * sizeof(float);
+    if (pwrite(_fd, ids32.data(), rows * _k * sizeof(int32_t), ids_offset) != rows * _k * (int64_t)sizeof(int32_t) ||
+        pwrite(_fd, dis, rows * _k * sizeof(float), dis_offset) != rows * _k * (int64_t)sizeof(float) ||
+        fdatasync(_fd) != 0) {
+      fprintf(stderr, "Could not write ground truth block\n");
+      abort();
+    }
+  }
+};
+
+/**
+ * @brief Read-only mapping of a ground truth file.
+ */
+class GroundTruthView {
+  void *_map = MAP_FAILED;
+  size_t _size = 0;
+  int64_t _n = 0;
+  int64_t _k = 0;
+
+public:
+  explicit GroundTruthView(std::string fname) {
+    int fd = open(fname.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t)(2 * sizeof(uint32_t))) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      throw std::runtime_error("Could not read " + fname);
+    }
+    _size = st.st_size;
+    _map = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (_map == MAP_FAILED) {
+      throw std::runtime_error("Could not map " + fname);
+    }
+    const uint32_t *header = static_cast<const uint32_t *>(_map);
+    _n = header[0];
+    _k = header[1];
+    if ((int64_t)_size < (int64_t)(2 * sizeof(uint32_t) + _n * _k * (sizeof(int32_t) + sizeof(float)))) {
+      munmap(_map, _size);
+      throw std::runtime_error("Truncated ground truth file " + fname);
+    }
+  }
+
+  ~GroundTruthView() {
+    if (_map != MAP_FAILED) {
+      munmap(_map, _size);
+    }
+  }
+
+  GroundTruthView(const GroundTruthView &) = delete;
+  GroundTruthView &operator=(const GroundTruthView &) = delete;
+
+  int64_t n() const { return _n; }
+  int64_t k() const { return _k; }
+
+  // The k neighbor ids and distances of query i
+  const int32_t *ids(int64_t i) const {
+    return reinterpret_cast<const int32_t *>(static_cast<const char *>(_map) + 2 * sizeof(uint32_t)) + i * _k;
+  }
+  const float *distances(int64_t i) const {
+    return reinterpret_cast<const float *>(ids(_n)) + i * _k;
+  }
+};
+
+// Fraction of the top-k ground truth of each query found in its top-k
+// results; the ground truth rows hold gt_k >= k ids, best first. Queries
+// are checked in parallel.
+template <typename GtId>
+float recall_at_k(const int64_t *nns, const GtId *gt_nns, int64_t n_query,
+                  int64_t k, int64_t gt_k) {
+  int64_t recalls = 0;
+  #pragma omp parallel for reduction(+ : recalls)
+  for (int64_t i = 0; i < n_query; ++i) {
+    for (int64_t n = 0; n < k; n++) {
+      for (int64_t m = 0; m < k; m++) {
+        if (nns[i * k + n] == gt_nns[i * gt_k + m]) {
+          recalls += 1;
+        }
+      }
+    }
+  }
+  return 1.0f * recalls / (k * n_query);
+}
+
+// Same against the first n_query queries of a ground truth file, which
+// must hold at least that many queries and k neighbors each
+float recall_at_k(const int64_t *nns, const GroundTruthView &gt, int64_t n_query, int64_t k) {
+  if (gt.n() < n_query || gt.k() < k) {
+    fprintf(stderr, "Ground truth has %ld queries x %ld neighbors, need %ld x %ld\n",
+            (long)gt.n(), (long)gt.k(), (long)n_query, (long)k);
+    abort();
+  }
+  return recall_at_k(nns, gt.ids(0), n_query, k, gt.k());
+}
+
+// Write n x d floats in the same layout read_bin_dataset() reads
+void write_bin_dataset(std::string fname, const float *data, int64_t n, int64_t d) {
+  std::ofstream datafile(fname, std::ofstream::binary);
+  uint32_t N_uint32 = n;
+  uint32_t dim_uint32 = d;
+  datafile.write((char *)&N_uint32, sizeof(uint32_t));
+  datafile.write((char *)&dim_uint32, sizeof(uint32_t));
+  datafile.write(reinterpret_cast<const char *>(data), (size_t)n * (size_t)d * sizeof(float));
+  if (!datafile) {
+    fprintf(stderr, "Could not write %s\n", fname.c_str());
+    abort();
+  }
+  printf("[INFO] Wrote file - N:%li, dim:%li\n", n, d);
+}